@@ -0,0 +1,303 @@
+/** \ingroup rpmbuild
+ * \file build/filecache.c
+ *  On-disk cache of per-file build data (digests, classification)
+ */
+
+#include "system.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+
+#include "rpmbuild_internal.h"
+
+#include "debug.h"
+
+#define HASHTYPE cacheIndex
+#define HTKEYTYPE const char *
+#define HTDATATYPE int
+#include "rpmhash.H"
+#include "rpmhash.C"
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+
+#define FILECACHE_MAGIC "rpmbuild-filecache 1"
+
+/*
+ * A cached value is only valid as long as the file it was calculated
+ * from stays the same, as far as stat() can tell.
+ */
+typedef struct cacheEntry_s {
+    char *key;			/* value name and file path */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    char *value;
+    int used;			/* looked up or stored in this build? */
+} * cacheEntry;
+
+struct fileCache_s {
+    char *path;			/* cache file */
+    struct cacheEntry_s *entries;
+    int nentries;
+    int alloced;
+    cacheIndex index;		/* key -> entry index */
+    int dirty;
+};
+
+static char *mkKey(const char *name, const char *path)
+{
+    return rstrscat(NULL, name, "\t", path, NULL);
+}
+
+static void setStat(cacheEntry e, const struct stat *st)
+{
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtim.tv_sec;
+    e->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+static int matchStat(const struct cacheEntry_s *e, const struct stat *st)
+{
+    return (e->dev == (uint64_t)st->st_dev &&
+	    e->ino == (uint64_t)st->st_ino &&
+	    e->size == (uint64_t)st->st_size &&
+	    e->mtime == (int64_t)st->st_mtim.tv_sec &&
+	    e->mtime_nsec == (int64_t)st->st_mtim.tv_nsec);
+}
+
+static cacheEntry addEntry(fileCache c, char *key)
+{
+    cacheEntry e;
+
+    if (c->nentries == c->alloced) {
+	c->alloced += 1024;
+	c->entries = xrealloc(c->entries, c->alloced * sizeof(*c->entries));
+    }
+    e = &c->entries[c->nentries];
+    memset(e, 0, sizeof(*e));
+    e->key = key;
+    cacheIndexAddEntry(c->index, e->key, c->nentries);
+    c->nentries++;
+    return e;
+}
+
+static cacheEntry findEntry(fileCache c, const char *key)
+{
+    int *ix = NULL;
+    if (cacheIndexGetEntry(c->index, key, &ix, NULL, NULL))
+	return &c->entries[ix[0]];
+    return NULL;
+}
+
+/* Keys and values are stored tab separated, one entry per line */
+static void escape(FILE *f, const char *s)
+{
+    for (; *s; s++) {
+	switch (*s) {
+	case '\\':	fputs("\\\\", f);	break;
+	case '\t':	fputs("\\t", f);	break;
+	case '\n':	fputs("\\n", f);	break;
+	default:	fputc(*s, f);		break;
+	}
+    }
+}
+
+static void unescape(char *s)
+{
+    char *t = s;
+    for (; *s; s++) {
+	if (*s == '\\' && s[1]) {
+	    s++;
+	    *t++ = (*s == 't') ? '\t' : (*s == 'n') ? '\n' : *s;
+	} else {
+	    *t++ = *s;
+	}
+    }
+    *t = '\0';
+}
+
+static void cacheLoad(fileCache c)
+{
+    FILE *f = fopen(c->path, "r");
+    char *line = NULL;
+    size_t linesz = 0;
+    ssize_t nb;
+    int lineno = 0;
+
+    if (f == NULL)
+	return;
+
+    while ((nb = getline(&line, &linesz, f)) > 0) {
+	char *fields[7];
+	char *s = line;
+	int nf = 0;
+
+	if (line[nb-1] == '\n')
+	    line[nb-1] = '\0';
+
+	if (lineno++ == 0) {
+	    if (!rstreq(line, FILECACHE_MAGIC))
+		break;
+	    continue;
+	}
+
+	for (nf = 0; nf < 7 && s; nf++) {
+	    fields[nf] = s;
+	    s = strchr(s, '\t');
+	    if (s)
+		*s++ = '\0';
+	}
+	if (nf != 7 || s != NULL)
+	    continue;
+
+	unescape(fields[1]);
+	unescape(fields[6]);
+	char *key = mkKey(fields[0], fields[1]);
+	if (findEntry(c, key)) {
+	    free(key);
+	    continue;
+	}
+
+	cacheEntry e = addEntry(c, key);
+	e->dev = strtoull(fields[2], NULL, 10);
+	e->ino = strtoull(fields[3], NULL, 10);
+	e->size = strtoull(fields[4], NULL, 10);
+	e->mtime = strtoll(fields[5], &s, 10);
+	e->mtime_nsec = (*s == '.') ? strtoll(s+1, NULL, 10) : 0;
+	e->value = xstrdup(fields[6]);
+    }
+    free(line);
+    fclose(f);
+
+    rpmlog(RPMLOG_DEBUG, "loaded %d entries from file cache %s\n",
+	   c->nentries, c->path);
+}
+
+/* Only the entries used in this build are kept */
+static void cacheSave(fileCache c)
+{
+    char *tmppath = rstrscat(NULL, c->path, ".tmp", NULL);
+    FILE *f = fopen(tmppath, "w");
+    int nused = 0;
+
+    if (f == NULL)
+	goto err;
+
+    fprintf(f, "%s\n", FILECACHE_MAGIC);
+    for (int i = 0; i < c->nentries; i++) {
+	cacheEntry e = &c->entries[i];
+	if (!e->used)
+	    continue;
+	/* Name and path are separate fields */
+	const char *path = strchr(e->key, '\t') + 1;
+	fprintf(f, "%.*s\t", (int)(path - e->key - 1), e->key);
+	escape(f, path);
+	fprintf(f, "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRId64 ".%09" PRId64 "\t",
+		e->dev, e->ino, e->size, e->mtime, e->mtime_nsec);
+	escape(f, e->value);
+	fputc('\n', f);
+	nused++;
+    }
+
+    if (fclose(f) || rename(tmppath, c->path))
+	goto err;
+
+    rpmlog(RPMLOG_DEBUG, "saved %d entries to file cache %s\n",
+	   nused, c->path);
+    free(tmppath);
+    return;
+
+err:
+    rpmlog(RPMLOG_WARNING, _("Unable to save file cache %s: %s\n"),
+	   c->path, strerror(errno));
+    unlink(tmppath);
+    free(tmppath);
+}
+
+fileCache fileCacheNew(const char *path)
+{
+    fileCache c = NULL;
+
+    if (path && *path) {
+	c = (fileCache)xcalloc(1, sizeof(*c));
+	c->path = xstrdup(path);
+	c->index = cacheIndexCreate(4096, rstrhash, strcmp, NULL, NULL);
+	cacheLoad(c);
+    }
+    return c;
+}
+
+fileCache fileCacheFree(fileCache c)
+{
+    if (c) {
+	int nused = 0;
+	for (int i = 0; i < c->nentries; i++)
+	    nused += c->entries[i].used;
+	if (c->dirty || nused != c->nentries)
+	    cacheSave(c);
+
+	for (int i = 0; i < c->nentries; i++) {
+	    free(c->entries[i].key);
+	    free(c->entries[i].value);
+	}
+	free(c->entries);
+	cacheIndexFree(c->index);
+	free(c->path);
+	free(c);
+    }
+    return NULL;
+}
+
+char *fileCacheGet(fileCache c, const char *name, const char *path,
+		   const struct stat *st)
+{
+    char *value = NULL;
+
+    if (c == NULL || st == NULL)
+	return NULL;
+
+    char *key = mkKey(name, path);
+    #pragma omp critical(filecache)
+    {
+    cacheEntry e = findEntry(c, key);
+    if (e && matchStat(e, st)) {
+	e->used = 1;
+	value = xstrdup(e->value);
+    }
+    } /* omp critical */
+    free(key);
+
+    return value;
+}
+
+void fileCachePut(fileCache c, const char *name, const char *path,
+		  const struct stat *st, const char *value)
+{
+    if (c == NULL || st == NULL || value == NULL)
+	return;
+
+    char *key = mkKey(name, path);
+    #pragma omp critical(filecache)
+    {
+    cacheEntry e = findEntry(c, key);
+    if (e) {
+	free(key);
+	free(e->value);
+    } else {
+	e = addEntry(c, key);
+    }
+    setStat(e, st);
+    e->value = xstrdup(value);
+    e->used = 1;
+    c->dirty = 1;
+    } /* omp critical */
+}
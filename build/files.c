@@ -1017,6 +1017,77 @@ static int seenHardLink(FileRecords files, FileListRec flp, rpm_ino_t *fileid)
     return 0;
 }
 
+/**
+ * Calculate the hex digest of a file, reusing the cached one if the file
+ * hasn't changed since.
+ * @param fcache	file cache (or NULL)
+ * @param algo		digest algorithm
+ * @param path		file path
+ * @param[out] buf	digest (BUFSIZ)
+ */
+static void fileDigest(fileCache fcache, int algo, const char *path, char *buf)
+{
+    struct stat sb;
+    char name[32];
+    char *cached = NULL;
+    int usecache = (fcache && stat(path, &sb) == 0);
+
+    snprintf(name, sizeof(name), "digest%d", algo);
+    if (usecache)
+	cached = fileCacheGet(fcache, name, path, &sb);
+
+    if (cached && strlen(cached) < BUFSIZ) {
+	strcpy(buf, cached);
+    } else if (rpmDoDigest(algo, path, 1, (unsigned char *)buf) == 0) {
+	if (usecache)
+	    fileCachePut(fcache, name, path, &sb, buf);
+    }
+    free(cached);
+}
+
+/**
+ * Calculate the digests of the regular files ending up in the header in
+ * parallel. With duplicates, the last entry is the one added, with the
+ * flags of all of them merged.
+ * @param fl		package file tree walk data
+ * @param fcache	file cache (or NULL)
+ * @param algo		digest algorithm
+ * @return		(no. files) hex digests, NULL for files without one
+ */
+static char **genFileDigests(FileList fl, fileCache fcache, int algo)
+{
+    int nfiles = fl->files.used;
+    char **digests = (char **)xcalloc(nfiles + 1, sizeof(*digests));
+    int *todo = (int *)xmalloc((nfiles + 1) * sizeof(*todo));
+    int ntodo = 0;
+    rpmfileAttrs flags = 0;
+
+    for (int i = 0; i < nfiles; i++) {
+	FileListRec flp = &fl->files.recs[i];
+
+	flags |= flp->flags;
+	if (i < nfiles - 1 && rstreq(flp->cpioPath, flp[1].cpioPath))
+	    continue;
+	if (S_ISREG(flp->fl_mode) &&
+		!(flags & (RPMFILE_GHOST | RPMFILE_EXCLUDE)))
+	    todo[ntodo++] = i;
+	flags = 0;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int j = 0; j < ntodo; j++) {
+	FileListRec flp = &fl->files.recs[todo[j]];
+	char buf[BUFSIZ];
+
+	buf[0] = '\0';
+	fileDigest(fcache, algo, flp->diskPath, buf);
+	digests[todo[j]] = xstrdup(buf);
+    }
+
+    free(todo);
+    return digests;
+}
+
 /**
  * Add file entries to header.
  * @todo Should directories have %doc/%config attributes? (#14531)
@@ -1029,6 +1100,7 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
 {
     FileListRec flp;
     char buf[BUFSIZ];
+    char **digests = NULL;
     int i, npaths = 0;
     int fail_on_dupes = rpmExpandNumeric("%{?_duplicate_files_terminate_build}") > 0;
     uint32_t defaultalgo = RPM_HASH_SHA256, digestalgo;
@@ -1124,6 +1196,8 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
     
     pkg->dpaths = (char **)xmalloc((fl->files.used + 1) * sizeof(*pkg->dpaths));
 
+    digests = genFileDigests(fl, spec->fcache, digestalgo);
+
     /* Generate the header. */
     for (i = 0, flp = fl->files.recs; i < fl->files.used; i++, flp++) {
 	rpm_ino_t fileid = flp - fl->files.recs;
@@ -1255,9 +1329,12 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
 	}
 	
 	buf[0] = '\0';
-	if (S_ISREG(flp->fl_mode) && !(flp->flags & RPMFILE_GHOST))
-	    (void) rpmDoDigest(digestalgo, flp->diskPath, 1, 
-			       (unsigned char *)buf);
+	if (S_ISREG(flp->fl_mode) && !(flp->flags & RPMFILE_GHOST)) {
+	    if (digests[i])
+		rstrlcpy(buf, digests[i], sizeof(buf));
+	    else
+		fileDigest(spec->fcache, digestalgo, flp->diskPath, buf);
+	}
 	headerPutString(h, RPMTAG_FILEDIGESTS, buf);
 	
 	buf[0] = '\0';
@@ -1337,6 +1414,10 @@ static void genCpioListAndHeader(FileList fl, rpmSpec spec, Package pkg, int isS
 	/* Binary packages with dirNames cannot be installed by legacy rpm. */
 	(void) rpmlibNeedsFeature(pkg, "CompressedFileNames", "3.0.4-1");
     }
+
+    for (i = 0; i < fl->files.used; i++)
+	free(digests[i]);
+    free(digests);
 }
 
 static FileRecords FileRecordsFree(FileRecords files)
@@ -3147,6 +3228,11 @@ rpmRC processBinaryFiles(rpmSpec spec, rpmBuildPkgFlags pkgFlags,
     check_fileList = newStringBuf();
     buildroot = rpmGenPath(spec->rootDir, spec->buildRoot, NULL);
 
+    {	char *cachepath = rpmGetPath("%{?_build_filecache}", NULL);
+	spec->fcache = fileCacheNew(cachepath);
+	free(cachepath);
+    }
+
     if (processDebug)
 	dbgsrcpkg = findDebugsourcePackage(spec);
 
@@ -3251,6 +3337,7 @@ rpmRC processBinaryFiles(rpmSpec spec, rpmBuildPkgFlags pkgFlags,
     }
 exit:
     check_fileList = freeStringBuf(check_fileList);
+    spec->fcache = fileCacheFree(spec->fcache);
     _free(buildroot);
     _free(uniquearch);
     
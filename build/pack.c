@@ -6,6 +6,8 @@
 #include "system.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 
@@ -13,7 +15,7 @@
 #include <rpm/rpmfileutil.h>
 #include <rpm/rpmlog.h>
 
-#include "rpmio_internal.h"	/* fdInitDigest, fdFiniDigest */
+#include "rpmio_internal.h"	/* fdInitDigest, fdFiniDigest, fdZstd* */
 #include "fsm.h"
 #include "signature.h"
 #include "rpmlead.h"
@@ -22,12 +24,132 @@
 
 #include "debug.h"
 
+/*
+ * Store of compressed file contents, keyed by the file digest within a
+ * directory per compressor setting. Each stored file goes into a zstd
+ * frame of its own so the compressed frame can be copied verbatim into
+ * the payload of later builds.
+ */
+typedef struct payloadStore_s {
+    char *dir;			/* directory for the current compressor */
+    rpm_loff_t minsize;		/* smaller files aren't worth a frame */
+    int nreused;
+    int nstored;
+} * payloadStore;
+
+static payloadStore payloadStoreNew(FD_t cfd)
+{
+    char *top = rpmExpand("%{?_build_payload_store}", NULL);
+    char *params = NULL;
+    payloadStore store = NULL;
+
+    if (*top == '\0')
+	goto exit;
+
+    if ((params = fdZstdParams(cfd)) == NULL) {
+	rpmlog(RPMLOG_DEBUG, "payload store requires zstd compression\n");
+	goto exit;
+    }
+
+    store = (payloadStore)xcalloc(1, sizeof(*store));
+    store->dir = rstrscat(NULL, top, "/", params, NULL);
+    store->minsize = rpmExpandNumeric("%{?_build_payload_store_minsize}");
+    if (rpmioMkpath(store->dir, 0755, -1, -1)) {
+	rpmlog(RPMLOG_WARNING, _("Unable to create payload store %s: %s\n"),
+	       store->dir, strerror(errno));
+	free(store->dir);
+	free(store);
+	store = NULL;
+    }
+
+exit:
+    free(params);
+    free(top);
+    return store;
+}
+
+static payloadStore payloadStoreFree(payloadStore store)
+{
+    if (store) {
+	rpmlog(RPMLOG_DEBUG, "payload store %s: %d files reused, %d stored\n",
+	       store->dir, store->nreused, store->nstored);
+	free(store->dir);
+	free(store);
+    }
+    return NULL;
+}
+
+/*
+ * Write the contents of the current archive file in a frame of its own,
+ * copying the compressed frame from the store if it's there already.
+ */
+static int payloadStoreWriteFile(payloadStore store, rpmfi archive,
+				 FD_t cfd, FD_t rfd)
+{
+    int algo = 0;
+    char *digest = rpmfiFDigestHex(archive, &algo);
+    rpm_loff_t size = rpmfiFSize(archive);
+    char *path = NULL;
+    char *tmppath = NULL;
+    FILE *fp = NULL;
+    int rc;
+
+    /* Empty files don't make a frame */
+    if (digest == NULL || *digest == '\0' || size == 0 ||
+	    fdZstdEndFrame(cfd)) {
+	free(digest);
+	return rpmfiArchiveWriteFile(archive, rfd);
+    }
+
+    rasprintf(&path, "%s/%d-%s", store->dir, algo, digest);
+    /* A stored frame of the wrong size is replaced by a fresh one */
+    if ((fp = fopen(path, "r")) != NULL && fdZstdReplay(cfd, fp, size)) {
+	rpmlog(RPMLOG_DEBUG, "payload store: size mismatch in %s\n", path);
+	fclose(fp);
+	fp = NULL;
+    }
+    if (fp == NULL) {
+	int fd;
+	tmppath = rstrscat(NULL, path, ".XXXXXX", NULL);
+	if ((fd = mkstemp(tmppath)) >= 0 && (fp = fdopen(fd, "w")) == NULL)
+	    close(fd);
+	if (fp && fdZstdCapture(cfd, fp, size)) {
+	    fclose(fp);
+	    fp = NULL;
+	}
+    }
+
+    rc = rpmfiArchiveWriteFile(archive, rfd);
+    /* Always end the frame, it's using fp */
+    if (fdZstdEndFrame(cfd) && !rc)
+	rc = RPMERR_WRITE_FAILED;
+
+    if (tmppath) {
+	int failed = (fp == NULL || ferror(fp));
+	if (fp && fclose(fp))
+	    failed = 1;
+	if (rc || failed || rename(tmppath, path))
+	    unlink(tmppath);
+	else
+	    store->nstored++;
+    } else if (fp) {
+	fclose(fp);
+	store->nreused++;
+    }
+
+    free(tmppath);
+    free(path);
+    free(digest);
+    return rc;
+}
+
 static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 				  FD_t cfd, ARGV_t dpaths,
 				  rpm_loff_t * archiveSize, char ** failedFile)
 {
     int rc = 0;
     rpmfi archive = rpmfiNewArchiveWriter(cfd, fi);
+    payloadStore store = payloadStoreNew(cfd);
 
     while (!rc && (rc = rpmfiNext(archive)) >= 0) {
         /* Copy file into archive. */
@@ -37,6 +159,8 @@ static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 	rfd = Fopen(path, "r.ufdio");
 	if (Ferror(rfd)) {
 	    rc = RPMERR_OPEN_FAILED;
+	} else if (store && rpmfiFSize(archive) >= store->minsize) {
+	    rc = payloadStoreWriteFile(store, archive, cfd, rfd);
 	} else {
 	    rc = rpmfiArchiveWriteFile(archive, rfd);
 	}
@@ -62,46 +186,218 @@ static int rpmPackageFilesArchive(rpmfiles fi, int isSrc,
 	*archiveSize = (rc == 0) ? rpmfiArchiveTell(archive) : 0;
 
     rpmfiFree(archive);
+    payloadStoreFree(store);
 
     return rc;
 }
+
+/*
+ * Compression thread budget shared by the binary packages being written
+ * in parallel. Each payload gets threads in proportion to its share of the
+ * data still to be compressed, and returns them once done.
+ */
+static struct payloadThreads_s {
+    int total;		/* threads to share, 0 when not building in parallel */
+    int avail;		/* threads not currently in use */
+    uint64_t pending;	/* uncompressed size of payloads not written yet */
+} payloadThreads;
+
+static void payloadThreadsInit(Package *pkgs, int npkgs)
+{
+    memset(&payloadThreads, 0, sizeof(payloadThreads));
+#ifdef _OPENMP
+    payloadThreads.total = rpmExpandNumeric("%{getncpus:thread}");
+    payloadThreads.avail = payloadThreads.total;
+    for (int i = 0; i < npkgs; i++) {
+	if (pkgs[i]->fileList)
+	    payloadThreads.pending += headerGetNumber(pkgs[i]->header,
+						      RPMTAG_LONGSIZE);
+    }
+#endif
+}
+
+/*
+ * Rewrite the thread count ("T<n>", T or T0 for automatic) of the payload
+ * compression mode according to the budget.
+ */
+static char *payloadThreadsGet(Package pkg, const char *fmode, int *nthreads)
+{
+    const char *t = strchr(fmode, 'T');
+    char *end = NULL;
+    char *mode = NULL;
+    int n = 0;
+
+    *nthreads = 0;
+    if (t == NULL || payloadThreads.total == 0)
+	return xstrdup(fmode);
+
+    n = strtol(t + 1, &end, 10);
+
+    #pragma omp critical(payloadthreads)
+    {
+    uint64_t size = headerGetNumber(pkg->header, RPMTAG_LONGSIZE);
+    uint64_t pending = payloadThreads.pending;
+    int share = payloadThreads.total;
+
+    if (pending > size)
+	share = (payloadThreads.total * size + pending - 1) / pending;
+
+    if (n <= 0 || n > share)
+	n = share;
+    if (n > payloadThreads.avail)
+	n = payloadThreads.avail;
+    if (n < 1)
+	n = 1;
+    payloadThreads.avail -= n;
+    } /* omp critical */
+
+    /* A single thread is best handled by the single-threaded compressor */
+    if (n > 1)
+	rasprintf(&mode, "%.*sT%d%s", (int)(t - fmode), fmode, n, end);
+    else
+	rasprintf(&mode, "%.*s%s", (int)(t - fmode), fmode, end);
+
+    rpmlog(RPMLOG_DEBUG, "%s: compressing payload with %d thread(s)\n",
+	   headerGetString(pkg->header, RPMTAG_NAME), n);
+    *nthreads = n;
+    return mode;
+}
+
+static void payloadThreadsPut(Package pkg, int nthreads)
+{
+    if (nthreads == 0)
+	return;
+
+    #pragma omp critical(payloadthreads)
+    {
+    uint64_t size = headerGetNumber(pkg->header, RPMTAG_LONGSIZE);
+    payloadThreads.avail += nthreads;
+    payloadThreads.pending -= (size < payloadThreads.pending) ?
+				size : payloadThreads.pending;
+    } /* omp critical */
+}
+
+struct payloadWriter_s {
+    int rfd;		/* read end of the payload pipe */
+    FD_t fdo;		/* package file */
+    int rc;
+};
+
+/*
+ * Copy the compressed payload from the pipe into the package file,
+ * updating the digests attached to the package fd on the way.
+ */
+static void *payloadWriter(void *arg)
+{
+    struct payloadWriter_s *pw = (struct payloadWriter_s *)arg;
+    size_t bufsiz = 32*BUFSIZ;
+    unsigned char *buf = (unsigned char *)xmalloc(bufsiz);
+    ssize_t nb;
+
+    while ((nb = read(pw->rfd, buf, bufsiz)) != 0) {
+	if (nb < 0) {
+	    if (errno == EINTR)
+		continue;
+	    pw->rc = -1;
+	    break;
+	}
+	/* Keep draining on errors so the compressor doesn't block */
+	if (pw->rc == 0 && Fwrite(buf, 1, nb, pw->fdo) != nb)
+	    pw->rc = -1;
+    }
+    free(buf);
+    return NULL;
+}
+
 /**
+ * Write the payload through a pipe so the compressed stream gets digested
+ * as it's written, instead of reading the whole payload back afterwards.
  * @todo Create transaction set *much* earlier.
  */
 static rpmRC cpio_doio(FD_t fdo, Package pkg, const char * fmodeMacro,
-			int pld_algo,
-			rpm_loff_t *archiveSize, char ** pldig)
+			int pld_algo, rpm_loff_t *archiveSize,
+			char ** pldig, char ** upldig)
 {
     char *failedFile = NULL;
+    struct payloadWriter_s pw = { -1, fdo, 0 };
+    pthread_t writer;
+    int pfd[2];
+    FD_t pfdo;
     FD_t cfd;
-    int fsmrc;
+    int fsmrc = RPMERR_OPEN_FAILED;
+    int nthreads = 0;
+    int terr;
+    char *fmode = NULL;
 
     (void) Fflush(fdo);
-    cfd = Fdopen(fdDup(Fileno(fdo)), fmodeMacro);
-    if (cfd == NULL)
+    if (pipe(pfd) < 0) {
+	rpmlog(RPMLOG_ERR, _("Could not create pipe for %s: %s\n"),
+	       Fdescr(fdo), strerror(errno));
 	return RPMRC_FAIL;
+    }
+#ifdef F_SETPIPE_SZ
+    /* Fewer round trips between the compressor and the writer */
+    (void) fcntl(pfd[1], F_SETPIPE_SZ, 1024*1024);
+#endif
 
-    /* Calculate alternative (uncompressed) payload digest while writing */
-    fdInitDigestID(cfd, pld_algo, RPMTAG_PAYLOADDIGESTALT, 0);
-    fsmrc = rpmPackageFilesArchive(pkg->cpioList, headerIsSource(pkg->header),
-				   cfd, pkg->dpaths,
-				   archiveSize, &failedFile);
-    fdFiniDigest(cfd, RPMTAG_PAYLOADDIGESTALT, (void **)pldig, NULL, 1);
-
-    if (fsmrc) {
-	char *emsg = rpmfileStrerror(fsmrc);
-	if (failedFile)
-	    rpmlog(RPMLOG_ERR, _("create archive failed on file %s: %s\n"),
-		   failedFile, emsg);
-	else
-	    rpmlog(RPMLOG_ERR, _("create archive failed: %s\n"), emsg);
-	free(emsg);
+    /* Calculate compressed payload digest while writing */
+    fdInitDigestID(fdo, pld_algo, RPMTAG_PAYLOADDIGEST, 0);
+    pw.rfd = pfd[0];
+    if ((terr = pthread_create(&writer, NULL, payloadWriter, &pw)) != 0) {
+	rpmlog(RPMLOG_ERR, _("Could not create payload writer: %s\n"),
+	       strerror(terr));
+	close(pfd[0]);
+	close(pfd[1]);
+	return RPMRC_FAIL;
+    }
+
+    fmode = payloadThreadsGet(pkg, fmodeMacro, &nthreads);
+    pfdo = fdDup(pfd[1]);
+    cfd = Fdopen(pfdo, fmode);
+    /* The compressor has its own copy, the writer sees EOF once it closes */
+    close(pfd[1]);
+
+    if (cfd == NULL) {
+	/* Nobody else will close the copy, and the writer waits for EOF */
+	if (pfdo)
+	    Fclose(pfdo);
+	rpmlog(RPMLOG_ERR, _("Could not open payload compressor (%s) for %s\n"),
+	       fmode, Fdescr(fdo));
+    } else {
+	/* Calculate alternative (uncompressed) payload digest while writing */
+	fdInitDigestID(cfd, pld_algo, RPMTAG_PAYLOADDIGESTALT, 0);
+	fsmrc = rpmPackageFilesArchive(pkg->cpioList,
+				       headerIsSource(pkg->header),
+				       cfd, pkg->dpaths,
+				       archiveSize, &failedFile);
+	fdFiniDigest(cfd, RPMTAG_PAYLOADDIGESTALT, (void **)upldig, NULL, 1);
+
+	if (fsmrc) {
+	    char *emsg = rpmfileStrerror(fsmrc);
+	    if (failedFile)
+		rpmlog(RPMLOG_ERR, _("create archive failed on file %s: %s\n"),
+		       failedFile, emsg);
+	    else
+		rpmlog(RPMLOG_ERR, _("create archive failed: %s\n"), emsg);
+	    free(emsg);
+	}
+	Fclose(cfd);
+    }
+    payloadThreadsPut(pkg, nthreads);
+
+    pthread_join(writer, NULL);
+    close(pfd[0]);
+    fdFiniDigest(fdo, RPMTAG_PAYLOADDIGEST, (void **)pldig, NULL, 1);
+
+    if (pw.rc) {
+	rpmlog(RPMLOG_ERR, _("Unable to write payload to %s: %s\n"),
+	       Fdescr(fdo), Fstrerror(fdo));
     }
 
     free(failedFile);
-    Fclose(cfd);
+    free(fmode);
 
-    return (fsmrc == 0) ? RPMRC_OK : RPMRC_FAIL;
+    return (fsmrc == 0 && pw.rc == 0) ? RPMRC_OK : RPMRC_FAIL;
 }
 
 static rpmRC addFileToTag(rpmSpec spec, const char * file,
@@ -521,16 +817,10 @@ static rpmRC writeRPM(Package pkg, unsigned char ** pkgidp,
 
     /* Write payload section (cpio archive) */
     payloadStart = Ftell(fd);
-    if (cpio_doio(fd, pkg, rpmio_flags, pld_algo, &archiveSize, &upld))
+    if (cpio_doio(fd, pkg, rpmio_flags, pld_algo, &archiveSize, &pld, &upld))
 	goto exit;
     payloadEnd = Ftell(fd);
 
-    /* Re-read payload to calculate compressed digest */
-    fdInitDigestID(fd, pld_algo, RPMTAG_PAYLOADDIGEST, 0);
-    if (fdConsume(fd, payloadStart, payloadEnd - payloadStart))
-	goto exit;
-    fdFiniDigest(fd, RPMTAG_PAYLOADDIGEST, (void **)&pld, NULL, 1);
-
     /* Insert the payload digests in main header */
     headerDel(pkg->header, RPMTAG_PAYLOADDIGEST);
     headerPutString(pkg->header, RPMTAG_PAYLOADDIGEST, pld);
@@ -570,6 +860,7 @@ exit:
     free(rpmio_flags);
     free(SHA1);
     free(SHA256);
+    free(pld);
     free(upld);
 
     /* XXX Fish the pkgid out of the signature header. */
@@ -764,6 +1055,7 @@ rpmRC packageBinaries(rpmSpec spec, const char *cookie, int cheating)
         pkg = pkg->next;
     }
     qsort(tasks, npkgs, sizeof(Package), compareBinaries);
+    payloadThreadsInit(tasks, npkgs);
 
     #pragma omp parallel
     #pragma omp single
@@ -784,6 +1076,8 @@ rpmRC packageBinaries(rpmSpec spec, const char *cookie, int cheating)
 	    break;
     }
 
+    payloadThreads.total = 0;
+
     /* Now check the package set if enabled */
     if (rc == RPMRC_OK)
 	rc = checkPackageSet(spec->packages);
@@ -564,6 +564,7 @@ retry:
 	}
 	*endFileName = '\0';
 
+	argvAdd(&spec->includes, fileName);
 	ofi = pushOFI(spec, fileName);
 	goto retry;
     }
@@ -124,6 +124,10 @@ struct Source * next;
 
 typedef struct Package_s * Package;
 
+typedef struct fileCache_s * fileCache;
+
+typedef struct specCache_s * specCache;
+
 /** \ingroup rpmbuild
  * The structure used to store values parsed from a spec file.
  */
@@ -174,8 +178,11 @@ struct rpmSpec_s {
     ARGI_t sectionops[NR_SECT];
 
     StringBuf parsed;		/*!< parsed spec contents */
+    ARGV_t includes;		/*!< files read through %include */
 
     Package packages;		/*!< Package list. */
+
+    fileCache fcache;		/*!< Cache of per-file data (or NULL) */
 };
 
 #define PACKAGE_NUM_DEPS 12
@@ -667,4 +674,82 @@ void doPatchMacro(rpmMacroBuf mb, rpmMacroEntry me, ARGV_t margs, size_t *parsed
 RPM_GNUC_INTERNAL
 const struct sectname_s *getSection(const char *name, int part);
 
+/** \ingroup rpmbuild
+ * Load the per-file data cache.
+ * @param path		cache file (NULL or empty to disable)
+ * @return		file cache (NULL if disabled)
+ */
+RPM_GNUC_INTERNAL
+fileCache fileCacheNew(const char *path);
+
+/** \ingroup rpmbuild
+ * Save the entries used in this build and free the file cache.
+ * @param c		file cache
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+fileCache fileCacheFree(fileCache c);
+
+/** \ingroup rpmbuild
+ * Look up a cached value of a file. Values are only returned if the file
+ * (device, inode, size and mtime) is unchanged since they were stored.
+ * @param c		file cache (or NULL)
+ * @param name		value name
+ * @param path		file path
+ * @param st		current stat() of the file
+ * @return		malloced value or NULL if not cached
+ */
+RPM_GNUC_INTERNAL
+char *fileCacheGet(fileCache c, const char *name, const char *path,
+		   const struct stat *st);
+
+/** \ingroup rpmbuild
+ * Store a value of a file in the cache.
+ * @param c		file cache (or NULL)
+ * @param name		value name
+ * @param path		file path
+ * @param st		stat() of the file the value was calculated from
+ * @param value		value to store
+ */
+RPM_GNUC_INTERNAL
+void fileCachePut(fileCache c, const char *name, const char *path,
+		  const struct stat *st, const char *value);
+
+/** \ingroup rpmbuild
+ * Set up the query result cache for a spec. The cache key covers the
+ * spec contents and the current macro configuration, so this must be
+ * called before parsing.
+ * @param specFile	spec file path
+ * @param flags		spec parse flags
+ * @param source	query source (RPMQV_SPEC*)
+ * @return		spec cache (NULL if disabled)
+ */
+RPM_GNUC_INTERNAL
+specCache specCacheNew(const char *specFile, rpmSpecFlags flags, int source);
+
+/** \ingroup rpmbuild
+ * Free a spec query result cache.
+ * @param sc		spec cache
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+specCache specCacheFree(specCache sc);
+
+/** \ingroup rpmbuild
+ * Look up cached query results, checking %include'd files for changes.
+ * @param sc		spec cache (or NULL)
+ * @return		NULL terminated array of headers (malloced) or NULL
+ */
+RPM_GNUC_INTERNAL
+Header *specCacheGet(specCache sc);
+
+/** \ingroup rpmbuild
+ * Store query results.
+ * @param sc		spec cache (or NULL)
+ * @param spec		parsed spec
+ * @param headers	NULL terminated array of headers to store
+ */
+RPM_GNUC_INTERNAL
+void specCachePut(specCache sc, rpmSpec spec, Header *headers);
+
 #endif /* _RPMBUILD_INTERNAL_H */
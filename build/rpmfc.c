@@ -16,6 +16,7 @@
 #include <rpm/argv.h>
 #include <rpm/rpmfc.h>
 #include <rpm/rpmlog.h>
+#include <rpm/rpmcrypto.h>
 #include <rpm/rpmfileutil.h>
 #include <rpm/rpmds.h>
 #include <rpm/rpmfi.h>
@@ -23,6 +24,9 @@
 
 #include "rpmfi_internal.h"		/* rpmfiles stuff for now */
 #include "rpmbuild_internal.h"
+#ifdef HAVE_LIBELF
+#include "rpmelfdeps.h"
+#endif
 
 #include "debug.h"
 
@@ -33,13 +37,31 @@ struct matchRule {
     ARGV_t flags;
 };
 
+/* Dependency types handled by the built-in generators */
+enum builtinDeps_e {
+    BUILTIN_PROVIDES	= (1 << 0),
+    BUILTIN_REQUIRES	= (1 << 1),
+};
+
 typedef struct rpmfcAttr_s {
     char *name;
     struct matchRule incl;
     struct matchRule excl;
     char *proto;
+    int builtin;	/* dependency types handled in-process */
+    int bslot;		/* slot in the per-file built-in deps */
+#ifdef HAVE_LIBELF
+    rpmElfdepsConfig elfprov;
+    rpmElfdepsConfig elfreq;
+#endif
 } * rpmfcAttr;
 
+/* Dependencies from the built-in generators */
+typedef struct {
+    ARGV_t provides;
+    ARGV_t requires;
+} rpmfcBuiltinDeps;
+
 typedef struct {
     int fileIx;
     rpmds dep;
@@ -76,6 +98,8 @@ struct rpmfc_s {
     char ** ftype;	/*!< (no. files) file types */
     ARGV_t *fattrs;	/*!< (no. files) file attribute tokens */
     rpm_color_t *fcolor;/*!< (no. files) file colors */
+    int nbuiltin;	/*!< no. of attributes with built-in generators */
+    rpmfcBuiltinDeps *fbuiltin; /*!< (no. files * nbuiltin) built-in deps */
     rpmsid *fcdictx;	/*!< (no. files) file class dictionary indices */
     ARGI_t fddictx;	/*!< (no. files) file depends dictionary start */
     ARGI_t fddictn;	/*!< (no. files) file depends dictionary no. entries */
@@ -85,6 +109,7 @@ struct rpmfc_s {
 
     fattrHash fahash;	/*!< attr:file mapping */
     rpmstrPool pool;	/*!< general purpose string storage */
+    fileCache fcache;	/*!< cache of per-file data (or NULL) */
 };
 
 struct rpmfcTokens_s {
@@ -193,13 +218,85 @@ static regex_t *rpmfcAttrReg(const char *arg, ...)
     return reg;
 }
 
+#ifdef HAVE_LIBELF
+/*
+ * The built-in ELF generator stands in for the elfdeps invocation of the
+ * attribute, and honors its options. Anything else in the command means
+ * the generator has been customized, and the external command is used.
+ */
+static int elfdepsConfig(const char *name, const char *dname,
+			 rpmElfdepsConfig *cfg)
+{
+    char *cmd = rpmExpand("%{?__", name, "_", dname, "} "
+			  "%{?__", name, "_", dname, "_opts}", NULL);
+    const char **av = NULL;
+    int ac = 0;
+    int requires = 0;
+    int ok = 0;
+
+    if (poptParseArgvString(cmd, &ac, &av) || ac < 1)
+	goto exit;
+
+    if (!rstreq(basename((char *)av[0]), "elfdeps"))
+	goto exit;
+
+    for (int i = 1; i < ac; i++) {
+	const char *opt = av[i];
+	if (rstreq(opt, "--soname-only"))
+	    cfg->soname_only = 1;
+	else if (rstreq(opt, "--no-fake-soname"))
+	    cfg->fake_soname = 0;
+	else if (rstreq(opt, "--no-filter-soname"))
+	    cfg->filter_soname = 0;
+	else if (rstreq(opt, "--require-interp"))
+	    cfg->require_interp = 1;
+	else if (rstreq(opt, "--requires") || rstreq(opt, "-R"))
+	    requires = 1;
+	else if (!(rstreq(opt, "--provides") || rstreq(opt, "-P") ||
+		   rstreq(opt, "--multifile") || rstreq(opt, "-m") ||
+		   rstreq(opt, "--server")))
+	    goto exit;
+    }
+
+    /* As elfdeps, generate requires if asked to and provides otherwise */
+    ok = (requires == rstreq(dname, "requires"));
+
+exit:
+    free(av);	/* XXX popt mallocs in single blob. */
+    free(cmd);
+    return ok;
+}
+#endif
+
+static void rpmfcAttrBuiltin(rpmfcAttr attr, const char *builtin)
+{
+#ifdef HAVE_LIBELF
+    if (rstreq(builtin, "elfdeps")) {
+	rpmElfdepsConfig init = RPMELFDEPS_CONFIG_INIT;
+	attr->elfprov = init;
+	attr->elfreq = init;
+	if (elfdepsConfig(attr->name, "provides", &attr->elfprov))
+	    attr->builtin |= BUILTIN_PROVIDES;
+	if (elfdepsConfig(attr->name, "requires", &attr->elfreq))
+	    attr->builtin |= BUILTIN_REQUIRES;
+	return;
+    }
+#endif
+    rpmlog(RPMLOG_DEBUG, "%s: built-in generator %s not available\n",
+	    attr->name, builtin);
+}
+
 static rpmfcAttr rpmfcAttrNew(const char *name)
 {
     rpmfcAttr attr = (rpmfcAttr)xcalloc(1, sizeof(*attr));
     struct matchRule *rules[] = { &attr->incl, &attr->excl, NULL };
+    char *builtin;
 
     attr->name = xstrdup(name);
     attr->proto = rpmfcAttrMacro(name, "protocol", NULL);
+    builtin = rpmfcAttrMacro(name, "builtin", NULL);
+    if (builtin)
+	rpmfcAttrBuiltin(attr, builtin);
     for (struct matchRule **rule = rules; rule && *rule; rule++) {
 	const char *prefix = (*rule == &attr->incl) ? NULL : "exclude";
 	char *flags;
@@ -229,6 +326,7 @@ static rpmfcAttr rpmfcAttrNew(const char *name)
 
 	free(flags);
     }
+    free(builtin);
 
     return attr;
 }
@@ -277,6 +375,145 @@ static rpmds rpmdsSingleNS(rpmstrPool pool,
 
 #define max(x,y) ((x) > (y) ? (x) : (y))
 
+/*
+ * Generators are started from several threads at once. Their pipes must
+ * not leak into each other's children, or one generator holding another's
+ * write end keeps it from ever seeing EOF.
+ */
+static int helperPipe(int fds[2])
+{
+#ifdef HAVE_PIPE2
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) < 0)
+	return -1;
+    (void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    (void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+static void helperFd(int fd, int target)
+{
+    /* dup2() clears close-on-exec on the copy, but not on itself */
+    if (fd == target)
+	(void) fcntl(fd, F_SETFD, 0);
+    else
+	dup2(fd, target);
+}
+
+/* Look up the executable the way execvp() would */
+static char *helperPath(const char *name)
+{
+    const char *path = getenv("PATH");
+    ARGV_t dirs = NULL;
+    char *fn = NULL;
+
+    if (strchr(name, '/'))
+	return xstrdup(name);
+
+    argvSplit(&dirs, path ? path : "/bin:/usr/bin", ":");
+    for (ARGV_t d = dirs; d && *d; d++) {
+	struct stat sb;
+	fn = rstrscat(NULL, **d ? *d : ".", "/", name, NULL);
+	if (stat(fn, &sb) == 0 && S_ISREG(sb.st_mode) && access(fn, X_OK) == 0)
+	    break;
+	fn = _free(fn);
+    }
+    argvFree(dirs);
+
+    return fn ? fn : xstrdup(name);
+}
+
+static ARGV_t helperEnv(const char *buildRoot)
+{
+    ARGV_t env = argvNew();
+
+    for (char **e = environ; e && *e; e++) {
+	if (rstreqn(*e, "DEBUGINFOD_URLS=", 16))
+	    continue;
+	if (buildRoot && rstreqn(*e, "RPM_BUILD_ROOT=", 15))
+	    continue;
+	argvAdd(&env, *e);
+    }
+    if (buildRoot) {
+	char *s = rstrscat(NULL, "RPM_BUILD_ROOT=", buildRoot, NULL);
+	argvAdd(&env, s);
+	free(s);
+    }
+    return env;
+}
+
+/*
+ * Fork and exec a helper with stdin and stdout connected to infd and
+ * outfd (if not -1). Everything is prepared before forking, the child
+ * only does async-signal-safe calls as other threads may hold locks.
+ */
+static pid_t helperSpawn(ARGV_const_t argv, const char *buildRoot,
+			 int infd, int outfd)
+{
+    char *path = helperPath(argv[0]);
+    ARGV_t env = helperEnv(buildRoot);
+    ARGV_t shargv = argvNew();
+    int errpipe[2] = { -1, -1 };
+    int err = 0;
+    pid_t child;
+
+    /* Scripts without #! are run with the shell, as execvp() does */
+    argvAdd(&shargv, "/bin/sh");
+    argvAdd(&shargv, path);
+    argvAppend(&shargv, argv + 1);
+
+    if (helperPipe(errpipe) < 0) {
+	rpmlog(RPMLOG_ERR, _("Couldn't create pipe for %s: %m\n"), argv[0]);
+	child = -1;
+	goto exit;
+    }
+
+    child = fork();
+    if (child < 0) {
+	rpmlog(RPMLOG_ERR, _("Couldn't fork %s: %s\n"),
+		argv[0], strerror(errno));
+	goto exit;
+    }
+    if (child == 0) {
+	signal(SIGPIPE, SIG_DFL);
+	if (infd >= 0)
+	    helperFd(infd, STDIN_FILENO);
+	if (outfd >= 0)
+	    helperFd(outfd, STDOUT_FILENO);
+
+	execve(path, (char *const *)argv, env);
+	if (errno == ENOEXEC)
+	    execve(shargv[0], shargv, env);
+	/* Let the parent know why */
+	err = errno;
+	(void) write(errpipe[1], &err, sizeof(err));
+	_exit(EXIT_FAILURE);
+    }
+
+    /* The error pipe closes on successful exec */
+    close(errpipe[1]);
+    errpipe[1] = -1;
+    while (read(errpipe[0], &err, sizeof(err)) < 0 && errno == EINTR)
+	{};
+    if (err) {
+	rpmlog(RPMLOG_ERR, _("Couldn't exec %s: %s\n"),
+		argv[0], strerror(err));
+    }
+    rpmlog(RPMLOG_DEBUG, "\texecv(%s) pid %d\n", argv[0], (unsigned)child);
+
+exit:
+    for (int i = 0; i < 2; i++) {
+	if (errpipe[i] >= 0)
+	    close(errpipe[i]);
+    }
+    argvFree(shargv);
+    argvFree(env);
+    free(path);
+    return child;
+}
+
 static int getOutputFrom(ARGV_t argv,
 			 const char * writePtr, size_t writeBytesLeft,
 			 StringBuf sb_stdout,
@@ -290,17 +527,25 @@ static int getOutputFrom(ARGV_t argv,
     int ret = 1; /* assume failure */
     int doio = (writePtr || sb_stdout);
 
-    if (doio && (pipe(toProg) < 0 || pipe(fromProg) < 0)) {
+    if (doio && (helperPipe(toProg) < 0 || helperPipe(fromProg) < 0)) {
 	rpmlog(RPMLOG_ERR, _("Couldn't create pipe for %s: %m\n"), argv[0]);
+	for (int i = 0; i < 2; i++) {
+	    if (toProg[i] >= 0)
+		close(toProg[i]);
+	}
 	return -1;
     }
     
     sighandler_t oldhandler = signal(SIGPIPE, SIG_IGN);
 
-    child = fork();
+    /*
+     * When expecting input, make stdin the in pipe as you'd normally do.
+     * Otherwise pass stdout(!) as the in pipe to cause reads to error
+     * out. Just closing the fd breaks some software (eg libtool).
+     */
+    child = helperSpawn(argv, buildRoot,
+			writePtr ? toProg[0] : fromProg[1], fromProg[1]);
     if (child < 0) {
-	rpmlog(RPMLOG_ERR, _("Couldn't fork %s: %s\n"),
-		argv[0], strerror(errno));
 	if (doio) {
 	    close(toProg[1]);
 	    close(toProg[0]);
@@ -310,39 +555,6 @@ static int getOutputFrom(ARGV_t argv,
 	ret = -1;
 	goto exit;
     }
-    if (child == 0) {
-	signal(SIGPIPE, SIG_DFL);
-
-	close(toProg[1]);
-	close(fromProg[0]);
-
-	/*
-	 * When expecting input, make stdin the in pipe as you'd normally do.
-	 * Otherwise pass stdout(!) as the in pipe to cause reads to error
-	 * out. Just closing the fd breaks some software (eg libtool).
-	 */
-	if (writePtr) {
-	    dup2(toProg[0], STDIN_FILENO);
-	    close(toProg[0]);
-	} else {
-	    dup2(fromProg[1], STDIN_FILENO);
-	}
-
-	dup2(fromProg[1], STDOUT_FILENO); /* Make stdout the out pipe */
-	close(fromProg[1]);
-
-	rpmlog(RPMLOG_DEBUG, "\texecv(%s) pid %d\n",
-                        argv[0], (unsigned)getpid());
-
-	unsetenv("DEBUGINFOD_URLS");
-	if (buildRoot)
-	    setenv("RPM_BUILD_ROOT", buildRoot, 1);
-
-	execvp(argv[0], (char *const *)argv);
-	rpmlog(RPMLOG_ERR, _("Couldn't exec %s: %s\n"),
-		argv[0], strerror(errno));
-	_exit(EXIT_FAILURE);
-    }
 
     if (!doio)
 	goto reap;
@@ -592,6 +804,116 @@ static ARGV_t runCall(const char *name, const char *buildRoot, ARGV_t fns)
     return output;
 }
 
+/*
+ * Server protocol: the generator is started once and fed one path per
+ * line. For each path it writes the dependencies of that file, one per
+ * line, followed by an empty line. The output is returned in the
+ * multifile format.
+ */
+static ARGV_t runServer(const char *name, const char *buildRoot, ARGV_t fns,
+			int *nerrors)
+{
+    ARGV_t output = NULL;
+    const char **av = NULL;
+    int ac = 0;
+    int toProg[2] = { -1, -1 };
+    int fromProg[2] = { -1, -1 };
+    FILE *out = NULL;
+    FILE *in = NULL;
+    char *line = NULL;
+    size_t linesz = 0;
+    pid_t child, reaped;
+    int status;
+    char *cmd = rpmExpand("%{", name, "} %{?", name, "_opts}", NULL);
+
+    if (poptParseArgvString(cmd, &ac, &av) || ac < 1)
+	goto exit;
+
+    if (helperPipe(toProg) < 0 || helperPipe(fromProg) < 0) {
+	rpmlog(RPMLOG_ERR, _("Couldn't create pipe for %s: %m\n"), av[0]);
+	(*nerrors)++;
+	goto exit;
+    }
+
+    child = helperSpawn((ARGV_const_t) av, buildRoot, toProg[0], fromProg[1]);
+    if (child < 0) {
+	(*nerrors)++;
+	goto exit;
+    }
+
+    close(toProg[0]);
+    close(fromProg[1]);
+    toProg[0] = fromProg[1] = -1;
+
+    /* The server must see EOF on its stdin below, close what isn't used */
+    if ((out = fdopen(toProg[1], "w")) == NULL)
+	close(toProg[1]);
+    if ((in = fdopen(fromProg[0], "r")) == NULL)
+	close(fromProg[0]);
+    toProg[1] = fromProg[0] = -1;
+    if (out == NULL || in == NULL) {
+	rpmlog(RPMLOG_ERR, _("Couldn't open pipe for %s: %m\n"), av[0]);
+	(*nerrors)++;
+    }
+
+    for (ARGV_t fn = fns; out && in && fn && *fn; fn++) {
+	ssize_t nb = 0;
+	int ndeps = 0;
+
+	if (fprintf(out, "%s\n", *fn) < 0 || fflush(out)) {
+	    nb = -1;
+	} else {
+	    while ((nb = getline(&line, &linesz, in)) > 0) {
+		while (nb > 0 && (line[nb-1] == '\n' || line[nb-1] == '\r'))
+		    line[--nb] = '\0';
+		/* Empty line terminates the dependencies of this file */
+		if (nb == 0)
+		    break;
+		if (ndeps++ == 0) {
+		    char *marker = rstrscat(NULL, ";", *fn, NULL);
+		    argvAdd(&output, marker);
+		    free(marker);
+		}
+		argvAdd(&output, line);
+	    }
+	}
+
+	if (nb < 0) {
+	    rpmlog(RPMLOG_ERR, _("%s: generator exited prematurely on %s\n"),
+		   av[0], *fn);
+	    (*nerrors)++;
+	    break;
+	}
+    }
+
+    /* Closing stdin tells the server to exit */
+    if (out)
+	fclose(out);
+    if (in)
+	fclose(in);
+
+    do {
+	reaped = waitpid(child, &status, 0);
+    } while (reaped == -1 && errno == EINTR);
+    if (reaped != -1) {
+	rpmlog(RPMLOG_DEBUG, "\twaitpid(%d) rc %d status %x\n",
+	    (unsigned)child, (unsigned)reaped, status);
+    }
+
+exit:
+    for (int i = 0; i < 2; i++) {
+	if (toProg[i] >= 0)
+	    close(toProg[i]);
+	if (fromProg[i] >= 0)
+	    close(fromProg[i]);
+    }
+    free(line);
+    free(av);	/* XXX popt mallocs in single blob. */
+    free(cmd);
+
+    return output;
+}
+
 struct addReqProvDataFc {
     rpmfc fc;
     const char *namespc;
@@ -636,20 +958,104 @@ static void exclFini(struct exclreg_s *excl)
     memset(excl, 0, sizeof(*excl));
 }
 
-static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
-		rpmsenseFlags dsContext, struct addReqProvDataFc *data,
-		int *fnx, int nfn, int fx, ARGV_t paths)
+/*
+ * A dependency generator run on a set of files. Generators are collected
+ * first and run afterwards, so the external ones can run concurrently.
+ */
+struct genBatch_s {
+    char *mname;		/* generator macro name */
+    int multifile;		/* all files in a single invocation? */
+    int server;			/* all files through a single server? */
+    int builtin;		/* built-in generator? */
+    const struct rpmfcAttr_s *attr; /* attribute of the generator */
+    int parametric;		/* parametric macro instead of a command */
+    int *fnx;			/* file indices */
+    int nfn;			/* no. of files */
+    rpmTagVal tagN;
+    rpmsenseFlags dsContext;
+    struct addReqProvDataFc data;
+    ARGV_t *output;		/* generator output per invocation */
+    int nerrors;		/* server protocol errors */
+};
+
+typedef struct genBatches_s {
+    struct genBatch_s *batches;
+    int nbatches;
+    int alloced;
+} * genBatches;
+
+/* Are all the files handled in a single run? */
+static int genSingleRun(const struct genBatch_s *b)
+{
+    return (b->multifile || b->server || b->builtin);
+}
+
+static int genNRuns(const struct genBatch_s *b)
 {
-    rpmfc fc = data->fc;
-    ARGV_t pav = NULL;
-    int rc = 0;
+    return genSingleRun(b) ? (b->nfn ? 1 : 0) : b->nfn;
+}
+
+/* Built-in dependencies of a file from an attribute */
+static rpmfcBuiltinDeps *builtinDeps(rpmfc fc, int ix,
+				     const struct rpmfcAttr_s *attr)
+{
+    return &fc->fbuiltin[ix * fc->nbuiltin + attr->bslot];
+}
 
-    if (rpmMacroIsParametric(NULL, mname)) {
-	pav = runCall(mname, fc->buildRoot, paths);
+/*
+ * The built-in generators ran already during classification, just
+ * collect their results in the multifile format.
+ */
+static ARGV_t runBuiltin(rpmfc fc, struct genBatch_s *b)
+{
+    ARGV_t output = NULL;
+
+    for (int i = 0; i < b->nfn; i++) {
+	int fx = b->fnx[i];
+	rpmfcBuiltinDeps *bdeps = builtinDeps(fc, fx, b->attr);
+	ARGV_t deps = (b->tagN == RPMTAG_PROVIDENAME) ?
+			bdeps->provides : bdeps->requires;
+	if (deps && *deps) {
+	    char *marker = rstrscat(NULL, ";", fc->fn[fx], NULL);
+	    argvAdd(&output, marker);
+	    argvAppend(&output, deps);
+	    free(marker);
+	}
+    }
+    return output;
+}
+
+static void genRun(rpmfc fc, struct genBatch_s *b, int run)
+{
+    const char **paths = (const char **)xcalloc(b->nfn + 1, sizeof(*paths));
+
+    if (genSingleRun(b)) {
+	for (int i = 0; i < b->nfn; i++)
+	    paths[i] = fc->fn[b->fnx[i]];
     } else {
-	pav = runCmd(mname, fc->buildRoot, paths);
+	paths[0] = fc->fn[b->fnx[run]];
     }
 
+    if (b->builtin)
+	b->output[run] = runBuiltin(fc, b);
+    else if (b->server)
+	b->output[run] = runServer(b->mname, fc->buildRoot, (ARGV_t) paths,
+				   &b->nerrors);
+    else if (b->parametric)
+	b->output[run] = runCall(b->mname, fc->buildRoot, (ARGV_t) paths);
+    else
+	b->output[run] = runCmd(b->mname, fc->buildRoot, (ARGV_t) paths);
+    free(paths);
+}
+
+static int genDeps(struct genBatch_s *b, int run, ARGV_t paths)
+{
+    rpmfc fc = b->data.fc;
+    ARGV_t pav = b->output[run];
+    int multifile = genSingleRun(b);
+    int fx = multifile ? -1 : run;
+    int rc = 0;
+
     for (int px = 0, pac = argvCount(pav); px < pac; px++) {
 	if (multifile && *pav[px] == ';') {
 	    int found = 0;
@@ -658,7 +1064,7 @@ static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
 		fx++;
 		if (rstreq(pav[px]+1, paths[fx]))
 		    found = 1;
-	    } while (!found && fx < nfn);
+	    } while (!found && fx < b->nfn);
 
 	    if (!found) {
 		rpmlog(RPMLOG_ERR,
@@ -670,48 +1076,136 @@ static int genDeps(const char *mname, int multifile, rpmTagVal tagN,
 	    continue;
 	}
 
-	if (parseRCPOT(NULL, fc->pkg, pav[px], tagN, fnx[fx],
-			dsContext, addReqProvFc, data)) {
+	if (parseRCPOT(NULL, fc->pkg, pav[px], b->tagN, b->fnx[fx],
+			b->dsContext, addReqProvFc, &b->data)) {
 	    rc++;
 	}
     }
-    argvFree(pav);
 
     return rc;
 }
 
-static int rpmfcHelper(rpmfc fc, int *fnx, int nfn, const char *proto,
+static void rpmfcHelper(rpmfc fc, int *fnx, int nfn,
+		       const struct rpmfcAttr_s *attr, const char *proto,
 		       const struct exclreg_s *excl,
 		       rpmsenseFlags dsContext, rpmTagVal tagN,
-		       const char *namespc, const char *mname)
+		       char *namespc, char *mname, genBatches gb)
 {
-    int rc = 0;
-    struct addReqProvDataFc data;
-    data.fc = fc;
-    data.namespc = namespc;
-    data.exclude = excl->exclude;
-
-    if (proto && rstreq(proto, "multifile")) {
-	const char **paths = (const char **)xcalloc(nfn + 1, sizeof(*paths));
-	for (int i = 0; i < nfn; i++)
-	    paths[i] = fc->fn[fnx[i]];
-	paths[nfn] = NULL;
-	rc = genDeps(mname, 1, tagN, dsContext, &data,
-			fnx, nfn, -1, (ARGV_t) paths);
-	free(paths);
-    } else {
-	for (int i = 0; i < nfn; i++) {
-	    const char *fn = fc->fn[fnx[i]];
-	    const char *paths[] = { fn, NULL };
+    struct genBatch_s *b;
+
+    if (gb->nbatches == gb->alloced) {
+	gb->alloced += 16;
+	gb->batches = xrealloc(gb->batches,
+			       gb->alloced * sizeof(*gb->batches));
+    }
+    b = &gb->batches[gb->nbatches++];
+    b->mname = mname;
+    b->multifile = (proto && rstreq(proto, "multifile"));
+    b->parametric = rpmMacroIsParametric(NULL, mname);
+    /* Parametric macros are called in-process anyway */
+    b->server = (proto && rstreq(proto, "server") && !b->parametric);
+    b->builtin = (proto && rstreq(proto, "builtin"));
+    b->attr = attr;
+    b->fnx = fnx;
+    b->nfn = nfn;
+    b->tagN = tagN;
+    b->dsContext = dsContext;
+    b->data.fc = fc;
+    b->data.namespc = namespc;
+    b->data.exclude = excl->exclude;
+    b->output = (ARGV_t *)xcalloc(genNRuns(b) + 1, sizeof(*b->output));
+}
 
-	    rc += genDeps(mname, 0, tagN, dsContext, &data,
-			fnx, nfn, i, (ARGV_t) paths);
+/*
+ * Run all collected generators. External commands are independent of
+ * each other and run in parallel, parametric macros (eg Lua) need the
+ * interpreter state and run serially.
+ */
+static void genRunAll(rpmfc fc, genBatches gb)
+{
+    struct genRun_s {
+	struct genBatch_s *b;
+	int run;
+    } *runs = NULL;
+    int nruns = 0;
+    int nparallel = 0;
+    sighandler_t oldhandler;
+
+    for (int i = 0; i < gb->nbatches; i++)
+	nruns += genNRuns(&gb->batches[i]);
+    runs = (struct genRun_s *)xcalloc(nruns + 1, sizeof(*runs));
+
+    /* External commands first so they get scheduled early */
+    nruns = 0;
+    for (int i = 0; i < gb->nbatches; i++) {
+	struct genBatch_s *b = &gb->batches[i];
+	if (b->parametric)
+	    continue;
+	for (int r = 0; r < genNRuns(b); r++, nruns++) {
+	    runs[nruns].b = b;
+	    runs[nruns].run = r;
 	}
     }
+    nparallel = nruns;
+    for (int i = 0; i < gb->nbatches; i++) {
+	struct genBatch_s *b = &gb->batches[i];
+	if (!b->parametric)
+	    continue;
+	for (int r = 0; r < genNRuns(b); r++, nruns++) {
+	    runs[nruns].b = b;
+	    runs[nruns].run = r;
+	}
+    }
+
+    /* Keep SIGPIPE ignored for the duration, getOutputFrom() restores it */
+    oldhandler = signal(SIGPIPE, SIG_IGN);
+
+    #pragma omp parallel for schedule(dynamic) if(nparallel > 1)
+    for (int i = 0; i < nparallel; i++)
+	genRun(fc, runs[i].b, runs[i].run);
 
+    signal(SIGPIPE, oldhandler);
+
+    for (int i = nparallel; i < nruns; i++)
+	genRun(fc, runs[i].b, runs[i].run);
+
+    free(runs);
+}
+
+/* Add the generated dependencies in the order the generators were added */
+static int genMergeAll(rpmfc fc, genBatches gb)
+{
+    int rc = 0;
+
+    for (int i = 0; i < gb->nbatches; i++) {
+	struct genBatch_s *b = &gb->batches[i];
+	const char **paths = (const char **)xcalloc(b->nfn + 1, sizeof(*paths));
+
+	for (int j = 0; j < b->nfn; j++)
+	    paths[j] = fc->fn[b->fnx[j]];
+	for (int r = 0; r < genNRuns(b); r++)
+	    rc += genDeps(b, r, (ARGV_t) paths);
+	rc += b->nerrors;
+	free(paths);
+    }
     return rc;
 }
 
+static void genBatchesFree(genBatches gb)
+{
+    for (int i = 0; i < gb->nbatches; i++) {
+	struct genBatch_s *b = &gb->batches[i];
+	for (int r = 0; r < genNRuns(b); r++)
+	    argvFree(b->output[r]);
+	free(b->output);
+	free(b->mname);
+	free((char *)b->data.namespc);
+	free(b->fnx);
+    }
+    free(gb->batches);
+    memset(gb, 0, sizeof(*gb));
+}
+
 /* Only used for controlling RPMTAG_FILECLASS inclusion now */
 static const struct rpmfcTokens_s rpmfcTokens[] = {
   { "directory",		RPMFC_INCLUDE },
@@ -788,8 +1282,16 @@ static int matches(const struct matchRule *rule,
     }
 }
 
-static void rpmfcAttributes(rpmfc fc, int ix, const char *ftype, const char *fmime, const char *fullpath)
+/*
+ * Fills in the matching attributes with a built-in generator (NULL
+ * terminated), returns their number.
+ */
+static int rpmfcAttributes(rpmfc fc, int ix,
+			const char *ftype, const char *fmime,
+			const char *fullpath,
+			const struct rpmfcAttr_s **builtins)
 {
+    int nbuiltins = 0;
     const char *path = fullpath + fc->brlen;
     int is_executable = 0;
     struct stat st;
@@ -808,8 +1310,12 @@ static void rpmfcAttributes(rpmfc fc, int ix, const char *ftype, const char *fmi
 	    argvAddTokens(&fc->fattrs[ix], (*attr)->name);
 	    #pragma omp critical(fahash)
 	    fattrHashAddEntry(fc->fahash, attr-fc->atypes, ix);
+	    if ((*attr)->builtin)
+		builtins[nbuiltins++] = *attr;
 	}
     }
+    builtins[nbuiltins] = NULL;
+    return nbuiltins;
 }
 
 /* Return color for a given libmagic classification string */
@@ -901,10 +1407,15 @@ rpmfc rpmfcFree(rpmfc fc)
 	    free(fc->ftype[i]);
 	    argvFree(fc->fattrs[i]);
 	}
+	for (int i = 0; fc->fbuiltin && i < fc->nfiles * fc->nbuiltin; i++) {
+	    argvFree(fc->fbuiltin[i].provides);
+	    argvFree(fc->fbuiltin[i].requires);
+	}
 	free(fc->fn);
 	free(fc->ftype);
 	free(fc->fattrs);
 	free(fc->fcolor);
+	free(fc->fbuiltin);
 	free(fc->fcdictx);
 	freePackage(fc->pkg);
 	argiFree(fc->fddictx);
@@ -1086,12 +1597,12 @@ static const struct applyDep_s applyDepTable[] = {
     { 0, 0, NULL },
 };
 
-static int applyAttr(rpmfc fc, int aix,
+static void applyAttr(rpmfc fc, int aix,
 			const struct rpmfcAttr_s *attr,
 			const struct exclreg_s *excl,
-			const struct applyDep_s *dep)
+			const struct applyDep_s *dep,
+			genBatches gb)
 {
-    int rc = 0;
     int n, *ixs;
 
     if (fattrHashGetEntry(fc->fahash, aix, &ixs, &n, NULL)) {
@@ -1117,14 +1628,18 @@ static int applyAttr(rpmfc fc, int aix,
 
 	if (rpmMacroIsDefined(NULL, mname)) {
 	    char *ns = rpmfcAttrMacro(aname, "namespace", NULL);
-	    rc = rpmfcHelper(fc, fnx, nfn, attr->proto,
-			    excl, dep->type, dep->tag, ns, mname);
-	    free(ns);
+	    int builtin = (dep->tag == RPMTAG_PROVIDENAME) ?
+			  (attr->builtin & BUILTIN_PROVIDES) :
+			  (dep->tag == RPMTAG_REQUIRENAME) ?
+			  (attr->builtin & BUILTIN_REQUIRES) : 0;
+	    rpmfcHelper(fc, fnx, nfn, attr,
+			    builtin ? "builtin" : attr->proto,
+			    excl, dep->type, dep->tag, ns, mname, gb);
+	} else {
+	    free(mname);
+	    free(fnx);
 	}
-	free(mname);
-	free(fnx);
     }
-    return rc;
 }
 
 static rpmRC rpmfcApplyInternal(rpmfc fc)
@@ -1137,25 +1652,35 @@ static rpmRC rpmfcApplyInternal(rpmfc fc)
     int ix;
     const struct applyDep_s *dep;
     int skip = 0;
-    struct exclreg_s excl;
+    int ndeps = sizeof(applyDepTable) / sizeof(applyDepTable[0]);
+    struct exclreg_s *excls = (struct exclreg_s *)xcalloc(ndeps, sizeof(*excls));
+    struct genBatches_s gb = { NULL, 0, 0 };
 
     if (fc->skipProv)
 	skip |= RPMSENSE_FIND_PROVIDES;
     if (fc->skipReq)
 	skip |= RPMSENSE_FIND_REQUIRES;
 
-    /* Generate package and per-file dependencies. */
+    /* Collect the generators to run on the files */
     for (dep = applyDepTable; dep->tag; dep++) {
+	struct exclreg_s *excl = &excls[dep - applyDepTable];
 	int aix = 0;
 	if (skip & dep->type)
 	    continue;
-	exclInit(dep->name, &excl);
-	for (rpmfcAttr *attr = fc->atypes; attr && *attr; attr++, aix++) {
-	    if (applyAttr(fc, aix, (*attr), &excl, dep))
-		rc = RPMRC_FAIL;
-	}
-	exclFini(&excl);
+	exclInit(dep->name, excl);
+	for (rpmfcAttr *attr = fc->atypes; attr && *attr; attr++, aix++)
+	    applyAttr(fc, aix, (*attr), excl, dep, &gb);
     }
+
+    /* Generate package and per-file dependencies. */
+    genRunAll(fc, &gb);
+    if (genMergeAll(fc, &gb))
+	rc = RPMRC_FAIL;
+    genBatchesFree(&gb);
+    for (int i = 0; i < ndeps; i++)
+	exclFini(&excls[i]);
+    free(excls);
+
     /* No more additions after this, freeze pool to minimize memory use */
 
     rpmfcNormalizeFDeps(fc);
@@ -1224,6 +1749,8 @@ static int initAttrs(rpmfc fc)
 
     for (int i = 0; i < nattrs; i++) {
 	fc->atypes[i] = rpmfcAttrNew(all_attrs[i]);
+	if (fc->atypes[i]->builtin)
+	    fc->atypes[i]->bslot = fc->nbuiltin++;
     }
     fc->atypes[nattrs] = NULL;
 
@@ -1234,35 +1761,177 @@ static int initAttrs(rpmfc fc)
     return nattrs;
 }
 
-static uint32_t getElfColor(const char *fn)
+#ifdef HAVE_LIBELF
+static uint32_t getElfColor(Elf *elf)
 {
     uint32_t color = 0;
+    GElf_Ehdr ehdr;
+
+    if (elf && gelf_getehdr(elf, &ehdr)) {
+	switch (ehdr.e_ident[EI_CLASS]) {
+	case ELFCLASS64:
+	    color = RPMFC_ELF64;
+	    break;
+	case ELFCLASS32:
+	    color = RPMFC_ELF32;
+	    break;
+	}
+
+	/* Exceptions to coloring */
+	switch (ehdr.e_machine) {
+	case EM_BPF:
+	    color = 0;
+	    break;
+	}
+    }
+    return color;
+}
+#endif
+
 #ifdef HAVE_LIBELF
-    int fd = open(fn, O_RDONLY);
-    if (fd >= 0) {
+/* Cache entry name for built-in ELF dependencies, the options affect them */
+static char *elfdepsCacheName(const char *dname, const rpmElfdepsConfig *cfg)
+{
+    char *name = NULL;
+    rasprintf(&name, "elf%s:%d%d%d%d", dname,
+	      !!cfg->soname_only, !!cfg->fake_soname,
+	      !!cfg->filter_soname, !!cfg->require_interp);
+    return name;
+}
+
+static int elfdepsCacheGet(rpmfc fc, const char *name, const char *fn,
+			   const struct stat *stp, ARGV_t *deps)
+{
+    char *val = fileCacheGet(fc->fcache, name, fn, stp);
+    if (val) {
+	*deps = argvSplitString(val, "\n", ARGV_SKIPEMPTY);
+	free(val);
+	return 1;
+    }
+    return 0;
+}
+
+static void elfdepsCachePut(rpmfc fc, const char *name, const char *fn,
+			    const struct stat *stp, ARGV_const_t deps)
+{
+    char *val = argvJoin(deps, "\n");
+    fileCachePut(fc->fcache, name, fn, stp, val ? val : "");
+    free(val);
+}
+#endif
+
+#ifdef HAVE_LIBELF
+/* Look up the built-in deps of an attribute, return the ones still to do */
+static int elfdepsLookup(rpmfc fc, int ix, const struct rpmfcAttr_s *attr,
+			 const struct stat *stp)
+{
+    const char *fn = fc->fn[ix];
+    rpmfcBuiltinDeps *deps = builtinDeps(fc, ix, attr);
+    int todo = attr->builtin;
+
+    if (fc->skipProv)
+	todo &= ~BUILTIN_PROVIDES;
+    if (fc->skipReq)
+	todo &= ~BUILTIN_REQUIRES;
+
+    if (stp && (todo & BUILTIN_PROVIDES)) {
+	char *name = elfdepsCacheName("provides", &attr->elfprov);
+	if (elfdepsCacheGet(fc, name, fn, stp, &deps->provides))
+	    todo &= ~BUILTIN_PROVIDES;
+	free(name);
+    }
+    if (stp && (todo & BUILTIN_REQUIRES)) {
+	char *name = elfdepsCacheName("requires", &attr->elfreq);
+	if (elfdepsCacheGet(fc, name, fn, stp, &deps->requires))
+	    todo &= ~BUILTIN_REQUIRES;
+	free(name);
+    }
+    return todo;
+}
+
+static void elfdepsGenerate(rpmfc fc, int ix, const struct rpmfcAttr_s *attr,
+			    int todo, Elf *elf, int isExec,
+			    const struct stat *stp)
+{
+    const char *fn = fc->fn[ix];
+    rpmfcBuiltinDeps *deps = builtinDeps(fc, ix, attr);
+
+    if (todo & BUILTIN_PROVIDES) {
+	rpmElfdeps(elf, fn, isExec, &attr->elfprov, &deps->provides, NULL);
+	if (stp) {
+	    char *name = elfdepsCacheName("provides", &attr->elfprov);
+	    elfdepsCachePut(fc, name, fn, stp, deps->provides);
+	    free(name);
+	}
+    }
+    if (todo & BUILTIN_REQUIRES) {
+	rpmElfdeps(elf, fn, isExec, &attr->elfreq, NULL, &deps->requires);
+	if (stp) {
+	    char *name = elfdepsCacheName("requires", &attr->elfreq);
+	    elfdepsCachePut(fc, name, fn, stp, deps->requires);
+	    free(name);
+	}
+    }
+}
+#endif
+
+/*
+ * Get the ELF color of a file and run the built-in ELF dependency
+ * generators of all matching attributes on it, using a single libelf
+ * handle.
+ */
+static uint32_t getElfInfo(rpmfc fc, int ix, int wantcolor,
+			   const struct rpmfcAttr_s **builtins,
+			   const struct stat *stp)
+{
+    uint32_t color = 0;
+#ifdef HAVE_LIBELF
+    const char *fn = fc->fn[ix];
+    int *todo = (int *)xcalloc(fc->nbuiltin + 1, sizeof(*todo));
+    int anytodo = 0;
+    int fd;
+
+    /* The file is opened following symlinks, only cache regular files */
+    if (stp && !S_ISREG(stp->st_mode))
+	stp = NULL;
+
+    if (stp && wantcolor) {
+	char *val = fileCacheGet(fc->fcache, "elfcolor", fn, stp);
+	if (val) {
+	    color = strtoul(val, NULL, 10);
+	    wantcolor = 0;
+	    free(val);
+	}
+    }
+    for (int i = 0; builtins[i]; i++) {
+	todo[i] = elfdepsLookup(fc, ix, builtins[i], stp);
+	anytodo |= todo[i];
+    }
+
+    if ((wantcolor || anytodo) && (fd = open(fn, O_RDONLY)) >= 0) {
 	Elf *elf = elf_begin (fd, ELF_C_READ, NULL);
-	GElf_Ehdr ehdr;
-	if (elf && gelf_getehdr(elf, &ehdr)) {
-	    switch (ehdr.e_ident[EI_CLASS]) {
-	    case ELFCLASS64:
-		color = RPMFC_ELF64;
-		break;
-	    case ELFCLASS32:
-		color = RPMFC_ELF32;
-		break;
+	struct stat st;
+
+	if (wantcolor) {
+	    color = getElfColor(elf);
+	    if (stp) {
+		char val[16];
+		snprintf(val, sizeof(val), "%u", color);
+		fileCachePut(fc->fcache, "elfcolor", fn, stp, val);
 	    }
+	}
 
-	    /* Exceptions to coloring */
-	    switch (ehdr.e_machine) {
-	    case EM_BPF:
-		color = 0;
-		break;
-	    }
+	if (elf && anytodo && fstat(fd, &st) == 0) {
+	    int isExec = (st.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH));
+
+	    for (int i = 0; builtins[i]; i++)
+		elfdepsGenerate(fc, ix, builtins[i], todo[i], elf, isExec, stp);
 	}
 	if (elf)
 	    elf_end(elf);
 	close(fd);
     }
+    free(todo);
 #endif
     return color;
 }
@@ -1285,11 +1954,56 @@ static const struct skipped_extension_s skipped_extensions[] = {
 	{ NULL, NULL, NULL }
 };
 
+/*
+ * Cache entry name for libmagic results. They depend on the libmagic
+ * version, the flags and the magic database, which is identified by the
+ * size and modification time of its files.
+ */
+static char *magicCacheName(const char *kind, int flags)
+{
+    const char *dbpath = magic_getpath(NULL, 0);
+    const char *suffixes[] = { ".mgc", "", NULL };
+    DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    ARGV_t dbs = NULL;
+    char *digest = NULL;
+    char *name = NULL;
+    char *id = NULL;
+
+    rasprintf(&id, "%d %x", magic_version(), flags);
+    rpmDigestUpdate(ctx, id, strlen(id) + 1);
+    free(id);
+
+    argvSplit(&dbs, dbpath ? dbpath : "", ":");
+    for (ARGV_t db = dbs; db && *db; db++) {
+	for (const char **sfx = suffixes; *sfx; sfx++) {
+	    char *fn = rstrscat(NULL, *db, *sfx, NULL);
+	    struct stat st;
+	    if (stat(fn, &st) == 0) {
+		rasprintf(&id, "%s %llu %lld.%09ld", fn,
+			  (unsigned long long)st.st_size,
+			  (long long)st.st_mtim.tv_sec,
+			  (long)st.st_mtim.tv_nsec);
+		rpmDigestUpdate(ctx, id, strlen(id) + 1);
+		free(id);
+	    }
+	    free(fn);
+	}
+    }
+    argvFree(dbs);
+
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    name = rstrscat(NULL, kind, ":", digest, NULL);
+    free(digest);
+    return name;
+}
+
 rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 {
     int msflags = MAGIC_CHECK | MAGIC_COMPRESS | MAGIC_NO_CHECK_TOKENS | MAGIC_ERROR;
     int mimeflags = msflags | MAGIC_MIME_TYPE;
     int nerrors = 0;
+    char *magicname = NULL;
+    char *mimename = NULL;
     rpmRC rc = RPMRC_FAIL;
 
     if (fc == NULL) {
@@ -1311,6 +2025,8 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
     fc->ftype = (char **)xcalloc(fc->nfiles, sizeof(*fc->ftype));
     fc->fattrs = (ARGV_t *)xcalloc(fc->nfiles, sizeof(*fc->fattrs));
     fc->fcolor = (rpm_color_t *)xcalloc(fc->nfiles, sizeof(*fc->fcolor));
+    fc->fbuiltin = (rpmfcBuiltinDeps *)xcalloc(fc->nfiles * fc->nbuiltin + 1,
+					      sizeof(*fc->fbuiltin));
     fc->fcdictx = (rpmsid *)xcalloc(fc->nfiles, sizeof(*fc->fcdictx));
     fc->fahash = fattrHashCreate(fc->nfiles / 3, intId, intCmp, NULL, NULL);
 
@@ -1321,11 +2037,22 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
     /* Build (sorted) file class dictionary. */
     fc->cdict = rpmstrPoolCreate();
 
+    if (fc->fcache) {
+	magicname = magicCacheName("magic", msflags);
+	mimename = magicCacheName("mime", mimeflags);
+    }
+
+#ifdef HAVE_LIBELF
+    (void) elf_version(EV_CURRENT);
+#endif
+
     #pragma omp parallel
     {
     /* libmagic is not thread-safe, each thread needs to a private handle */
     magic_t ms = magic_open(msflags);
     magic_t mime = magic_open(mimeflags);
+    const struct rpmfcAttr_s **builtins = (const struct rpmfcAttr_s **)
+		xcalloc(fc->nbuiltin + 1, sizeof(*builtins));
 
     if (ms == NULL || mime == NULL) {
 	rpmlog(RPMLOG_ERR, _("magic_open(0x%x) failed: %s\n"),
@@ -1350,8 +2077,15 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 	size_t slen = strlen(s);
 	int extension_index = 0;
 	int fcolor = RPMFC_BLACK;
+	int nbuiltins;
 	rpm_mode_t mode = (fmode ? fmode[ix] : 0);
 	int is_executable = (mode & (S_IXUSR|S_IXGRP|S_IXOTH));
+	char *cftype = NULL;
+	char *cfmime = NULL;
+	struct stat sb, *stp = NULL;
+
+	if (fc->fcache && lstat(s, &sb) == 0)
+	    stp = &sb;
 
 	switch (mode & S_IFMT) {
 	case S_IFCHR:	ftype = "character special";	break;
@@ -1376,7 +2110,11 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 	    if (slen >= fc->brlen+sizeof("/dev/") && rstreqn(s+fc->brlen, "/dev/", sizeof("/dev/")-1))
 		ftype = "";
 	    else if (ftype == NULL) {
-		ftype = magic_file(ms, s);
+		ftype = cftype = fileCacheGet(fc->fcache, magicname, s, stp);
+		if (ftype == NULL) {
+		    ftype = magic_file(ms, s);
+		    fileCachePut(fc->fcache, magicname, s, stp, ftype);
+		}
 		/* Silence errors from immaterial %ghosts */
 		if (ftype == NULL && errno == ENOENT)
 		    ftype = "";
@@ -1396,7 +2134,11 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 	}
 
 	if (fmime == NULL) { /* not predefined */
-	    fmime = magic_file(mime, s);
+	    fmime = cfmime = fileCacheGet(fc->fcache, mimename, s, stp);
+	    if (fmime == NULL) {
+		fmime = magic_file(mime, s);
+		fileCachePut(fc->fcache, mimename, s, stp, fmime);
+	    }
 	    /* Silence errors from immaterial %ghosts */
 	    if (fmime == NULL && errno == ENOENT)
 		fmime = "";
@@ -1421,20 +2163,25 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 	fcolor |= rpmfcColor(ftype);
 
 	/* Add attributes based on file type and/or path */
-	rpmfcAttributes(fc, ix, ftype, fmime, s);
+	nbuiltins = rpmfcAttributes(fc, ix, ftype, fmime, s, builtins);
 
 	if (fcolor != RPMFC_WHITE && (fcolor & RPMFC_INCLUDE))
 	    fc->ftype[ix] = xstrdup(ftype);
 
-	/* Add ELF colors */
-	if (S_ISREG(mode) && is_executable)
-	    fc->fcolor[ix] = getElfColor(s);
+	/* Add ELF colors and built-in dependencies */
+	if ((S_ISREG(mode) && is_executable) || nbuiltins) {
+	    fc->fcolor[ix] = getElfInfo(fc, ix, S_ISREG(mode) && is_executable,
+					builtins, stp);
+	}
+	free(cftype);
+	free(cfmime);
     }
 
     if (ms != NULL)
 	magic_close(ms);
     if (mime != NULL)
 	magic_close(mime);
+    free(builtins);
 
     } /* omp parallel */
 
@@ -1456,6 +2203,8 @@ rpmRC rpmfcClassify(rpmfc fc, ARGV_t argv, rpm_mode_t * fmode)
 exit:
     /* No more additions after this, freeze pool to minimize memory use */
     rpmstrPoolFreeze(fc->cdict, 0);
+    free(magicname);
+    free(mimename);
 
     return rc;
 }
@@ -1705,6 +2454,7 @@ rpmRC rpmfcGenerateDepends(const rpmSpec spec, Package pkg)
     fmode = (rpm_mode_t *)xcalloc(ac+1, sizeof(*fmode));
 
     fc = rpmfcCreate(spec->buildRoot, 0);
+    fc->fcache = spec->fcache;
     freePackage(fc->pkg);
     fc->pkg = pkg;
     fc->skipProv = !pkg->autoProv;
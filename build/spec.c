@@ -103,7 +103,7 @@ rpmRC lookupPackage(rpmSpec spec, const char *name, int flag,Package *pkg)
 Package newPackage(const char *name, rpmstrPool pool, Package *pkglist)
 {
     Package p = (Package)xcalloc(1, sizeof(*p));
-    p->header = headerNew();
+    p->header = headerNewWithFlags(HEADERNEW_ARENA);
     p->autoProv = 1;
     p->autoReq = 1;
     p->fileList = NULL;
@@ -259,6 +259,7 @@ rpmSpec rpmSpecFree(rpmSpec spec)
     for (int i = 0; i < NR_SECT; i++)
 	freeStringBuf(spec->sections[i]);
     freeStringBuf(spec->parsed);
+    argvFree(spec->includes);
 
     spec->buildRoot = _free(spec->buildRoot);
     spec->buildDir = _free(spec->buildDir);
@@ -452,38 +453,62 @@ const char * rpmSpecGetSection(rpmSpec spec, int section)
     return NULL;
 }
 
+/* Return the headers a spec query shows (NULL terminated) */
+static Header *specQueryHeaders(rpmSpec spec, int source)
+{
+    Header *headers = (Header *)xcalloc(1, sizeof(*headers));
+    int n = 0;
+
+    if (source == RPMQV_SPECRPMS || source == RPMQV_SPECBUILTRPMS) {
+	for (Package pkg = spec->packages; pkg != NULL; pkg = pkg->next) {
+
+	    if (source == RPMQV_SPECBUILTRPMS && pkg->fileList == NULL)
+		continue;
+
+	    headers = (Header *)xrealloc(headers, (n + 2) * sizeof(*headers));
+	    headers[n++] = headerLink(pkg->header);
+	}
+    } else {
+	headers = (Header *)xrealloc(headers, 2 * sizeof(*headers));
+	headers[n++] = headerLink(spec->sourcePackage->header);
+    }
+    headers[n] = NULL;
+    return headers;
+}
+
 int rpmspecQuery(rpmts ts, QVA_t qva, const char * arg)
 {
+    rpmSpecFlags flags = (RPMSPEC_ANYARCH|RPMSPEC_FORCE);
     rpmSpec spec = NULL;
+    specCache cache = NULL;
+    Header *headers = NULL;
     int res = 1;
 
     if (qva->qva_showPackage == NULL)
 	goto exit;
 
-    spec = rpmSpecParse(arg, (RPMSPEC_ANYARCH|RPMSPEC_FORCE), NULL);
-    if (spec == NULL) {
-	rpmlog(RPMLOG_ERR,
-	    		_("query of specfile %s failed, can't parse\n"), arg);
-	goto exit;
-    }
-
-    if (qva->qva_source == RPMQV_SPECRPMS ||
-	    qva->qva_source == RPMQV_SPECBUILTRPMS) {
-
-	res = 0;
-	for (Package pkg = spec->packages; pkg != NULL; pkg = pkg->next) {
-
-	    if (qva->qva_source == RPMQV_SPECBUILTRPMS && pkg->fileList == NULL)
-		continue;
-
-	    res += qva->qva_showPackage(qva, ts, pkg->header);
+    cache = specCacheNew(arg, flags, qva->qva_source);
+    headers = specCacheGet(cache);
+    if (headers == NULL) {
+	spec = rpmSpecParse(arg, flags, NULL);
+	if (spec == NULL) {
+	    rpmlog(RPMLOG_ERR,
+			    _("query of specfile %s failed, can't parse\n"), arg);
+	    goto exit;
 	}
-    } else {
-	Package sourcePkg = spec->sourcePackage;
-	res = qva->qva_showPackage(qva, ts, sourcePkg->header);
+	headers = specQueryHeaders(spec, qva->qva_source);
+	specCachePut(cache, spec, headers);
     }
 
+    res = 0;
+    for (Header *h = headers; *h; h++)
+	res += qva->qva_showPackage(qva, ts, *h);
+
 exit:
+    for (Header *h = headers; h && *h; h++)
+	headerFree(*h);
+    free(headers);
+    specCacheFree(cache);
     rpmSpecFree(spec);
     return res;
 }
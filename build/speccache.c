@@ -0,0 +1,224 @@
+/** \ingroup rpmbuild
+ * \file build/speccache.c
+ *  On-disk cache of spec query results
+ */
+
+#include "system.h"
+
+#include <errno.h>
+
+#include <rpm/header.h>
+#include <rpm/rpmcrypto.h>
+#include <rpm/rpmfileutil.h>
+#include <rpm/rpmlib.h>
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+
+#include "rpmmacro_internal.h"	/* rpmMacroContextDigest */
+#include "rpmbuild_internal.h"
+
+#include "debug.h"
+
+#define SPECCACHE_MAGIC "rpmspec-cache 1"
+#define SPECCACHE_ALGO RPM_HASH_SHA256
+
+/*
+ * Query results are stored in a file named by a digest of everything
+ * known before parsing: the spec, the macro configuration and the query.
+ * The first header of the file lists the %include'd files and their
+ * digests, which are checked on lookup, and the number of headers to
+ * show that follow it.
+ */
+struct specCache_s {
+    char *path;			/* cache entry of this query */
+};
+
+static char *fileDigest(const char *fn)
+{
+    unsigned char digest[2 * 64 + 1];
+
+    memset(digest, 0, sizeof(digest));
+    if (rpmDoDigest(SPECCACHE_ALGO, fn, 1, digest))
+	return NULL;
+    return xstrdup((char *)digest);
+}
+
+static void digestStr(DIGEST_CTX ctx, const char *s)
+{
+    rpmDigestUpdate(ctx, s, strlen(s) + 1);
+}
+
+specCache specCacheNew(const char *specFile, rpmSpecFlags flags, int source)
+{
+    char *dir = rpmExpand("%{?_spec_query_cache}", NULL);
+    char *specdig = NULL;
+    char *macrodig = NULL;
+    char *key = NULL;
+    specCache sc = NULL;
+    DIGEST_CTX ctx;
+    char buf[64];
+
+    if (*dir == '\0')
+	goto exit;
+
+    if ((specdig = fileDigest(specFile)) == NULL)
+	goto exit;
+    macrodig = rpmMacroContextDigest(NULL, SPECCACHE_ALGO);
+
+    ctx = rpmDigestInit(SPECCACHE_ALGO, RPMDIGEST_NONE);
+    digestStr(ctx, SPECCACHE_MAGIC);
+    digestStr(ctx, rpmEVR);
+    snprintf(buf, sizeof(buf), "%d %d", flags, source);
+    digestStr(ctx, buf);
+    digestStr(ctx, specFile);
+    digestStr(ctx, specdig);
+    digestStr(ctx, macrodig);
+    rpmDigestFinal(ctx, (void **)&key, NULL, 1);
+
+    if (rpmioMkpath(dir, 0755, -1, -1) == 0) {
+	sc = (specCache)xcalloc(1, sizeof(*sc));
+	sc->path = rstrscat(NULL, dir, "/", key, NULL);
+    }
+
+exit:
+    free(key);
+    free(macrodig);
+    free(specdig);
+    free(dir);
+    return sc;
+}
+
+specCache specCacheFree(specCache sc)
+{
+    if (sc) {
+	free(sc->path);
+	free(sc);
+    }
+    return NULL;
+}
+
+/* Check that the %include'd files haven't changed */
+static int checkIncludes(Header meta)
+{
+    struct rpmtd_s names, digests;
+    int valid = 0;
+
+    headerGet(meta, RPMTAG_OLDFILENAMES, &names, HEADERGET_MINMEM);
+    headerGet(meta, RPMTAG_FILEDIGESTS, &digests, HEADERGET_MINMEM);
+
+    if (rpmtdCount(&names) == rpmtdCount(&digests)) {
+	const char *fn, *dig;
+	valid = 1;
+	while (valid && (fn = rpmtdNextString(&names)) &&
+		(dig = rpmtdNextString(&digests))) {
+	    char *curdig = fileDigest(fn);
+	    if (curdig == NULL || !rstreq(curdig, dig))
+		valid = 0;
+	    free(curdig);
+	}
+    }
+
+    rpmtdFreeData(&names);
+    rpmtdFreeData(&digests);
+    return valid;
+}
+
+Header *specCacheGet(specCache sc)
+{
+    Header *headers = NULL;
+    int nheaders = 0;
+    uint32_t expected = 0;
+    Header meta = NULL;
+    Header h;
+    FD_t fd;
+
+    if (sc == NULL)
+	return NULL;
+
+    fd = Fopen(sc->path, "r.ufdio");
+    if (fd == NULL || Ferror(fd))
+	goto exit;
+
+    meta = headerRead(fd, HEADER_MAGIC_YES);
+    if (meta == NULL || !rstreq(headerGetString(meta, RPMTAG_NAME),
+				SPECCACHE_MAGIC) || !checkIncludes(meta))
+	goto exit;
+    if (!headerIsEntry(meta, RPMTAG_SIZE))
+	goto exit;
+    expected = headerGetNumber(meta, RPMTAG_SIZE);
+
+    headers = (Header *)xcalloc(1, sizeof(*headers));
+    while ((h = headerRead(fd, HEADER_MAGIC_YES)) != NULL) {
+	headers = (Header *)xrealloc(headers,
+				     (nheaders + 2) * sizeof(*headers));
+	headers[nheaders++] = h;
+	headers[nheaders] = NULL;
+    }
+
+    /* A truncated entry is a miss */
+    if (nheaders != expected) {
+	for (Header *hp = headers; *hp; hp++)
+	    headerFree(*hp);
+	headers = _free(headers);
+	goto exit;
+    }
+    rpmlog(RPMLOG_DEBUG, "using cached query results %s\n", sc->path);
+
+exit:
+    headerFree(meta);
+    if (fd)
+	Fclose(fd);
+    return headers;
+}
+
+void specCachePut(specCache sc, rpmSpec spec, Header *headers)
+{
+    char *tmppath = NULL;
+    Header meta = NULL;
+    FD_t fd = NULL;
+    uint32_t nheaders = 0;
+    int rc = -1;
+
+    if (sc == NULL)
+	return;
+
+    for (Header *h = headers; h && *h; h++)
+	nheaders++;
+
+    meta = headerNew();
+    headerPutString(meta, RPMTAG_NAME, SPECCACHE_MAGIC);
+    headerPutUint32(meta, RPMTAG_SIZE, &nheaders, 1);
+    for (ARGV_const_t inc = spec->includes; inc && *inc; inc++) {
+	char *dig = fileDigest(*inc);
+	if (dig == NULL)
+	    goto exit;
+	headerPutString(meta, RPMTAG_OLDFILENAMES, *inc);
+	headerPutString(meta, RPMTAG_FILEDIGESTS, dig);
+	free(dig);
+    }
+
+    tmppath = rstrscat(NULL, sc->path, ".XXXXXX", NULL);
+    fd = rpmMkTemp(tmppath);
+    if (fd == NULL)
+	goto exit;
+
+    rc = headerWrite(fd, meta, HEADER_MAGIC_YES);
+    for (Header *h = headers; rc == 0 && *h; h++)
+	rc = headerWrite(fd, *h, HEADER_MAGIC_YES);
+    if (Fclose(fd))
+	rc = -1;
+    fd = NULL;
+
+    if (rc == 0)
+	rc = rename(tmppath, sc->path);
+
+exit:
+    if (rc) {
+	rpmlog(RPMLOG_DEBUG, "unable to cache query results %s: %s\n",
+	       sc->path, strerror(errno));
+	if (tmppath)
+	    unlink(tmppath);
+    }
+    free(tmppath);
+    headerFree(meta);
+}
@@ -40,6 +40,28 @@ enum hMagic {
  */
 Header headerNew(void);
 
+/** \ingroup header
+ * Header creation flags
+ */
+enum headerNewFlags_e {
+    HEADERNEW_DEFAULT		= 0,
+    HEADERNEW_ARENA		= (1 << 0), /* Allocate tag data from an arena? */
+};
+
+typedef rpmFlags headerNewFlags;
+
+/** \ingroup header
+ * Create new (empty) header instance, with flags.
+ * With HEADERNEW_ARENA, tag data is carved out of large blocks owned by
+ * the header, making lots of small puts and appends cheap. Space of
+ * modified and deleted tags is only released with the header, so this
+ * suits headers that are built up once, such as those of packages
+ * being built.
+ * @param flags		header creation flags
+ * @return		header
+ */
+Header headerNewWithFlags(headerNewFlags flags);
+
 /** \ingroup header
  * Dereference a header instance.
  * @param h		header
@@ -89,6 +111,7 @@ Header headerCopy(Header h);
 enum headerImportFlags_e {
     HEADERIMPORT_COPY		= (1 << 0), /* Make copy of blob on import? */
     HEADERIMPORT_FAST		= (1 << 1), /* Faster but less safe? */
+    HEADERIMPORT_LAZY		= (1 << 2), /* Check and decode tags on first access? */
 };
 
 typedef rpmFlags headerImportFlags;
@@ -262,6 +285,46 @@ int headerDel(Header h, rpmTagVal tag);
  */
 char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg);
 
+/** \ingroup header
+ * Parse a query format for formatting any number of headers.
+ * A parsed format must not be used from several threads at once.
+ *
+ * @param fmt		format to use
+ * @param[out] errmsg	error message (if any)
+ * @return		parsed format, NULL on error
+ */
+headerQueryFormat headerFormatCompile(const char * fmt, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Return formatted output string from header tags, using a parsed format.
+ * The returned string must be free()d.
+ *
+ * @param qfmt		parsed format
+ * @param h		header
+ * @param[out] errmsg	error message (if any)
+ * @return		formatted output string (malloc'ed)
+ */
+char * headerFormatExec(headerQueryFormat qfmt, Header h, errmsg_t * errmsg);
+
+/** \ingroup header
+ * Free a parsed query format.
+ * @param qfmt		parsed format
+ * @return		NULL always
+ */
+headerQueryFormat headerFormatFree(headerQueryFormat qfmt);
+
+/** \ingroup header
+ * Return header tags as a JSON object on a single line, as used for
+ * newline delimited JSON. The values are formatted as with the :json
+ * query format, straight from the header data.
+ * The returned string must be free()d.
+ *
+ * @param h		header
+ * @param tags		0-terminated array of tags to include, NULL for all
+ * @return		JSON object with trailing newline (malloc'ed)
+ */
+char * headerJSON(Header h, const rpmTagVal * tags);
+
 /** \ingroup header
  * Duplicate tag values from one header into another.
  * @param headerFrom	source header
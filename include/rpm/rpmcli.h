@@ -117,14 +117,15 @@ enum rpmQueryFlags_e {
 	/* bits 19-21 unused */
     QUERY_FOR_LIST	= (1 << 23),	/*!< query:  from --list */
     QUERY_FOR_STATE	= (1 << 24),	/*!< query:  from --state */
-	/* bits 25-26 unused */
+    QUERY_FOR_JSON	= (1 << 25),	/*!< query:  from --ndjson */
+	/* bit 26 unused */
     QUERY_FOR_DUMPFILES	= (1 << 27),	/*!< query:  from --dump */
 };
 
 typedef rpmFlags rpmQueryFlags;
 
 #define	_QUERY_FOR_BITS	\
-   (QUERY_FOR_LIST|QUERY_FOR_STATE|QUERY_FOR_DUMPFILES)
+   (QUERY_FOR_LIST|QUERY_FOR_STATE|QUERY_FOR_DUMPFILES|QUERY_FOR_JSON)
 
 /** \ingroup rpmcli
  * Bit(s) from common command line options.
@@ -50,6 +50,15 @@ rpmRC rpmKeyringVerifySig(rpmKeyring keyring, pgpDigParams sig, DIGEST_CTX ctx);
  */
 rpmKeyring rpmKeyringLink(rpmKeyring keyring);
 
+/** \ingroup rpmkeyring
+ * Return digest of the keys in a keyring. Keyrings with the same keys
+ * have the same digest, regardless of the order the keys were added in.
+ * @param keyring	keyring handle
+ * @param algo		digest algorithm
+ * @return		digest as hex string (malloc'ed), NULL on error
+ */
+char * rpmKeyringDigest(rpmKeyring keyring, int algo);
+
 /** \ingroup rpmkeyring
  * Create a new rpmPubkey from OpenPGP packet
  * @param pkt		OpenPGP packet data
@@ -116,6 +116,17 @@ int rpmstrPoolStreq(rpmstrPool poolA, rpmsid sidA,
  */
 rpmsid rpmstrPoolNumStr(rpmstrPool pool);
 
+/** \ingroup rpmstrpool
+ * Return the sort key of an [epoch:]version[-release] string in the pool,
+ * as computed by rpmverKey(). The key is computed on first use and
+ * cached in the pool for the lifetime of the pool, so repeated version
+ * comparisons of pool strings reduce to strcmp() on their keys.
+ * @param pool		string pool
+ * @param sid		pool id of an EVR string
+ * @return		sort key, "" for an empty string, NULL on invalid id
+ */
+const char * rpmstrPoolEVRKey(rpmstrPool pool, rpmsid sid);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,7 @@ typedef const char *    errmsg_t;
  */
 typedef struct headerToken_s * Header;
 typedef struct headerIterator_s * HeaderIterator;
+typedef struct headerQueryFormat_s * headerQueryFormat;
 
 typedef uint32_t	rpm_tag_t;
 typedef uint32_t	rpm_tagtype_t;
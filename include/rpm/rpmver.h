@@ -17,6 +17,17 @@ extern "C" {
  */
 int rpmvercmp(const char * a, const char * b);
 
+/** \ingroup rpmver
+ * Return sort key of a version or release string. Comparing the keys
+ * of two strings with strcmp() gives the same result as comparing the
+ * strings with rpmvercmp(), which makes it possible to do the
+ * segment parsing just once for strings that get compared repeatedly.
+ *
+ * @param s		version or release string
+ * @return		sort key (malloced), NULL on NULL string
+ */
+char *rpmvercmpKey(const char * s);
+
 /** \ingroup rpmver
  * Parse rpm version handle from evr string
  *
@@ -82,6 +93,25 @@ char *rpmverEVR(rpmver rv);
  */
 int rpmverCmp(rpmver v1, rpmver v2);
 
+/** \ingroup rpmver
+ * Return sort key of rpm version handle. Comparing the keys of two
+ * version handles with strcmp() gives the same result as rpmverCmp().
+ *
+ * @param rv		rpm version handle
+ * @return		sort key (malloced), NULL on NULL handle
+ */
+char *rpmverKey(rpmver rv);
+
+/** \ingroup rpmver
+ * Sort an array of rpm version handles in ascending rpmverCmp() order.
+ * Sort keys are computed once per element, making this considerably
+ * cheaper than qsort() with rpmverCmp() on large arrays.
+ *
+ * @param vers		array of rpm version handles (NULL sorts first)
+ * @param nvers		number of elements in the array
+ */
+void rpmverSort(rpmver *vers, size_t nvers);
+
 /** \ingroup rpmver
  * Determine whether two versioned ranges overlap.
  * @param v1		1st version
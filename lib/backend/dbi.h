@@ -29,6 +29,8 @@ typedef struct dbiCursor_s * dbiCursor;
 
 struct dbConfig_s {
     int	db_no_fsync;	/*!< no-op fsync for db */
+    int	db_lazy_headers;/*!< decode header tags on first access */
+    int	db_verify_cache;/*!< remember verified headers across processes */
 };
 
 struct rpmdbOps_s;
@@ -45,6 +47,7 @@ struct rpmdb_s {
     int		db_perms;	/*!< open permissions */
     const char	* db_descr;	/*!< db backend description (for error msgs) */
     struct dbChk_s * db_checked;/*!< headerCheck()'ed package instances */
+    struct verifyCache_s * db_verified;/*!< ... by earlier processes too */
     rpmdb	db_next;
     int		db_opens;
     dbiIndex	db_pkgs;	/*!< Package db */
@@ -63,6 +63,35 @@ const int rpmFLAGS = RPMSENSE_EQUAL;
 #undef HASHTYPE
 #undef HTKEYTYPE
 
+/**
+ * Compiled rich dependency: the top-level split of a rich dependency
+ * string, parsed once per dependency check run. The operand dependency
+ * sets are shared by all evaluations of the same (name, tag, flags).
+ */
+typedef struct richDep_s {
+    rpmsid name;		/*!< Rich dependency string id */
+    rpmstrPool pool;		/*!< Pool of the string id */
+    rpmTagVal tag;		/*!< Dependency tag */
+    rpmsenseFlags flags;	/*!< Dependency flags */
+
+    rpmrichOp op;		/*!< Top-level operation */
+    rpmds ds1;			/*!< Left operand */
+    rpmds ds2;			/*!< Right operand */
+    rpmds ds21;			/*!< if/unless-else: condition */
+    rpmds ds22;			/*!< if/unless-else: else branch */
+    char *emsg;			/*!< Parse error (or NULL) */
+
+    int nelem;			/*!< No. of ts elements when rc was computed */
+    int rc;			/*!< Memoized result, -1 if not known */
+} * richDep;
+
+#define HASHTYPE richCache
+#define HTKEYTYPE richDep
+#include "rpmhash.H"
+#include "rpmhash.C"
+#undef HASHTYPE
+#undef HTKEYTYPE
+
 /**
  * Check for supported payload format in header.
  * @param h		header to check
@@ -617,7 +646,65 @@ static int rpmdbProvides(rpmts ts, depCache dcache, rpmds dep, dbiIndexSet *matc
     return rc;
 }
 
-static dbiIndexSet unsatisfiedDependSet(rpmts ts, rpmds dep)
+static unsigned int richDepHash(richDep rd)
+{
+    return (rd->name * 31 + rd->tag) * 31 + rd->flags;
+}
+
+static int richDepCmp(richDep a, richDep b)
+{
+    return (a->name != b->name || a->pool != b->pool ||
+	    a->tag != b->tag || a->flags != b->flags);
+}
+
+static richDep richDepFree(richDep rd)
+{
+    if (rd) {
+	rpmdsFree(rd->ds1);
+	rpmdsFree(rd->ds2);
+	rpmdsFree(rd->ds21);
+	rpmdsFree(rd->ds22);
+	free(rd->emsg);
+	free(rd);
+    }
+    return NULL;
+}
+
+/* Return the compiled form of a rich dependency, parsing it on first use */
+static richDep richDepGet(richCache rcache, rpmds dep)
+{
+    struct richDep_s key = {
+	.name = rpmdsNId(dep),
+	.pool = rpmdsPool(dep),
+	.tag = rpmdsTagN(dep),
+	.flags = rpmdsFlags(dep),
+    };
+    richDep rd = NULL;
+
+    if (richCacheGetEntry(rcache, &key, &rd))
+	return rd;
+
+    rd = (richDep)xcalloc(1, sizeof(*rd));
+    *rd = key;
+    rd->rc = -1;
+    if (rpmdsParseRichDep(dep, &rd->ds1, &rd->ds2, &rd->op, &rd->emsg) == RPMRC_OK) {
+	/* split a possible else clause of if/unless upfront */
+	if ((rd->op == RPMRICHOP_IF || rd->op == RPMRICHOP_UNLESS) &&
+		rpmdsIsRich(rd->ds2)) {
+	    rpmrichOp op2 = RPMRICHOP_NONE;
+	    if (rpmdsParseRichDep(rd->ds2, &rd->ds21, &rd->ds22, &op2, NULL) == RPMRC_OK && op2 != RPMRICHOP_ELSE) {
+		rd->ds21 = rpmdsFree(rd->ds21);
+		rd->ds22 = rpmdsFree(rd->ds22);
+	    }
+	}
+    } else {
+	rd->op = RPMRICHOP_NONE;
+    }
+    richCacheAddEntry(rcache, rd);
+    return rd;
+}
+
+static dbiIndexSet unsatisfiedDependSet(rpmts ts, richCache rcache, rpmds dep)
 {
     dbiIndexSet set1 = NULL, set2 = NULL;
     tsMembers tsmem = rpmtsMembers(ts);
@@ -627,28 +714,26 @@ static dbiIndexSet unsatisfiedDependSet(rpmts ts, rpmds dep)
 	goto exit;
 
     if (rpmdsIsRich(dep)) {
-	rpmds ds1, ds2; 
-	rpmrichOp op;
-	char *emsg = 0; 
+	richDep rd = richDepGet(rcache, dep);
+	rpmrichOp op = rd->op;
 
-	if (rpmdsParseRichDep(dep, &ds1, &ds2, &op, &emsg) != RPMRC_OK) {
-	    rpmdsNotify(dep, emsg ? emsg : "(parse error)", 1);  
-	    _free(emsg);
+	if (op == RPMRICHOP_NONE) {
+	    rpmdsNotify(dep, rd->emsg ? rd->emsg : "(parse error)", 1);  
 	    goto exit;
 	}
 	/* only a subset of ops is supported in set mode */
 	if (op != RPMRICHOP_WITH && op != RPMRICHOP_WITHOUT
             && op != RPMRICHOP_OR && op != RPMRICHOP_SINGLE) {
 	    rpmdsNotify(dep, "(unsupported op in set mode)", 1);  
-	    goto exit_rich;
+	    goto exit;
 	}
 
-	set1 = unsatisfiedDependSet(ts, ds1);
+	set1 = unsatisfiedDependSet(ts, rcache, rd->ds1);
 	if (op == RPMRICHOP_SINGLE)
-	    goto exit_rich;
+	    goto exit;
 	if (op != RPMRICHOP_OR && dbiIndexSetCount(set1) == 0)
-	    goto exit_rich;
-	set2 = unsatisfiedDependSet(ts, ds2);
+	    goto exit;
+	set2 = unsatisfiedDependSet(ts, rcache, rd->ds2);
 	if (op == RPMRICHOP_WITH) {
 	    dbiIndexSetFilterSet(set1, set2, 0);
 	} else if (op == RPMRICHOP_WITHOUT) {
@@ -656,9 +741,6 @@ static dbiIndexSet unsatisfiedDependSet(rpmts ts, rpmds dep)
 	} else if (op == RPMRICHOP_OR) {
 	    dbiIndexSetAppendSet(set1, set2, 0);
 	}
-exit_rich:
-	ds1 = rpmdsFree(ds1);
-	ds2 = rpmdsFree(ds2);
 	goto exit;
     }
 
@@ -684,10 +766,12 @@ exit:
  * Check dep for an unsatisfied dependency.
  * @param ts		transaction set
  * @param dcache	dependency cache
+ * @param rcache	rich dependency cache
  * @param dep		dependency
  * @return		0 if satisfied, 1 if not satisfied
  */
-static int unsatisfiedDepend(rpmts ts, depCache dcache, rpmds dep)
+static int unsatisfiedDepend(rpmts ts, depCache dcache, richCache rcache,
+			     rpmds dep)
 {
     tsMembers tsmem = rpmtsMembers(ts);
     int rc;
@@ -720,61 +804,54 @@ retry:
 
     /* Handle rich dependencies */
     if (rpmdsIsRich(dep)) {
-	rpmds ds1, ds2; 
-	rpmrichOp op;
-	char *emsg = 0; 
-	if (rpmdsParseRichDep(dep, &ds1, &ds2, &op, &emsg) != RPMRC_OK) {
+	richDep rd = richDepGet(rcache, dep);
+	rpmrichOp op = rd->op;
+	int nelem = rpmtsNElements(ts);
+
+	if (op == RPMRICHOP_NONE) {
 	    rc = rpmdsTagN(dep) == RPMTAG_CONFLICTNAME ? 0 : 1;
 	    if (rpmdsInstance(dep) != 0)
 		rc = !rc;	/* ignore errors for installed packages */
-	    rpmdsNotify(dep, emsg ? emsg : "(parse error)", rc);  
-	    _free(emsg);
+	    rpmdsNotify(dep, rd->emsg ? rd->emsg : "(parse error)", rc);  
+	    goto exit;
+	}
+	/* Results stay valid as long as no elements got added by solving */
+	if (rd->rc >= 0 && rd->nelem == nelem) {
+	    rc = rd->rc;
+	    rpmdsNotify(dep, "(rich cached)", rc);
 	    goto exit;
 	}
 	if (op == RPMRICHOP_WITH || op == RPMRICHOP_WITHOUT) {
 	    /* switch to set mode processing */
-	    dbiIndexSet set = unsatisfiedDependSet(ts, dep);
+	    dbiIndexSet set = unsatisfiedDependSet(ts, rcache, dep);
 	    rc = dbiIndexSetCount(set) ? 0 : 1;
 	    dbiIndexSetFree(set);
-	    ds1 = rpmdsFree(ds1);
-	    ds2 = rpmdsFree(ds2);
-	    rpmdsNotify(dep, "(rich)", rc);
-	    goto exit;
-	}
-	if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
+	} else if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
 	    /* A IF B -> A OR NOT(B) */
 	    /* A UNLESS B -> A AND NOT(B) */
-	    if (rpmdsIsRich(ds2)) {
-		/* check if this has an ELSE clause */
-		rpmds ds21 = NULL, ds22 = NULL;
-		rpmrichOp op2;
-		if (rpmdsParseRichDep(ds2, &ds21, &ds22, &op2, NULL) == RPMRC_OK && op2 == RPMRICHOP_ELSE) {
-		    /* A IF B ELSE C -> (A OR NOT(B)) AND (C OR B) */
-		    /* A UNLESS B ELSE C -> (A AND NOT(B)) OR (C AND B) */
-		    rc = !unsatisfiedDepend(ts, dcache, ds21);	/* NOT(B) */
-		    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS)) {
-			rc = unsatisfiedDepend(ts, dcache, ds1);	/* A */
-		    } else {
-			rc = unsatisfiedDepend(ts, dcache, ds22);	/* C */
-		    }
-		    rpmdsFree(ds21);
-		    rpmdsFree(ds22);
-		    goto exitrich;
+	    if (rd->ds21) {
+		/* A IF B ELSE C -> (A OR NOT(B)) AND (C OR B) */
+		/* A UNLESS B ELSE C -> (A AND NOT(B)) OR (C AND B) */
+		rc = !unsatisfiedDepend(ts, dcache, rcache, rd->ds21);	/* NOT(B) */
+		if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS)) {
+		    rc = unsatisfiedDepend(ts, dcache, rcache, rd->ds1);	/* A */
+		} else {
+		    rc = unsatisfiedDepend(ts, dcache, rcache, rd->ds22);	/* C */
 		}
-		rpmdsFree(ds21);
-		rpmdsFree(ds22);
+	    } else {
+		rc = !unsatisfiedDepend(ts, dcache, rcache, rd->ds2);	/* NOT(B) */
+		if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS))
+		    rc = unsatisfiedDepend(ts, dcache, rcache, rd->ds1);
 	    }
-	    rc = !unsatisfiedDepend(ts, dcache, ds2);	/* NOT(B) */
-	    if ((rc && op == RPMRICHOP_IF) || (!rc && op == RPMRICHOP_UNLESS))
-		rc = unsatisfiedDepend(ts, dcache, ds1);
 	} else {
-	    rc = unsatisfiedDepend(ts, dcache, ds1);
+	    rc = unsatisfiedDepend(ts, dcache, rcache, rd->ds1);
 	    if ((rc && op == RPMRICHOP_OR) || (!rc && op == RPMRICHOP_AND))
-		rc = unsatisfiedDepend(ts, dcache, ds2);
+		rc = unsatisfiedDepend(ts, dcache, rcache, rd->ds2);
+	}
+	if (nelem == rpmtsNElements(ts)) {
+	    rd->rc = rc;
+	    rd->nelem = nelem;
 	}
-exitrich:
-	ds1 = rpmdsFree(ds1);
-	ds2 = rpmdsFree(ds2);
 	rpmdsNotify(dep, "(rich)", rc);
 	goto exit;
     }
@@ -818,7 +895,7 @@ exit:
 }
 
 /* Check a dependency set for problems */
-static void checkDS(rpmts ts, depCache dcache, rpmte te,
+static void checkDS(rpmts ts, depCache dcache, richCache rcache, rpmte te,
 		const char * pkgNEVRA, rpmds ds,
 		rpm_color_t tscolor)
 {
@@ -833,13 +910,13 @@ static void checkDS(rpmts ts, depCache dcache, rpmte te,
 	if (tscolor && dscolor && !(tscolor & dscolor))
 	    continue;
 
-	if (unsatisfiedDepend(ts, dcache, ds) == is_problem)
+	if (unsatisfiedDepend(ts, dcache, rcache, ds) == is_problem)
 	    rpmteAddDepProblem(te, pkgNEVRA, ds, NULL);
     }
 }
 
 /* Check a given dependency against installed packages */
-static void checkInstDeps(rpmts ts, depCache dcache, rpmte te,
+static void checkInstDeps(rpmts ts, depCache dcache, richCache rcache, rpmte te,
 			  rpmTag depTag, const char *dep, rpmds depds, int neg)
 {
     Header h;
@@ -877,7 +954,7 @@ static void checkInstDeps(rpmts ts, depCache dcache, rpmte te,
 	if (depds && !rpmdsIsRich(ds))
 	    match = rpmdsCompare(ds, depds);
 
-	if (match && unsatisfiedDepend(ts, dcache, ds) == is_problem) {
+	if (match && unsatisfiedDepend(ts, dcache, rcache, ds) == is_problem) {
 	    char *pkgNEVRA = headerGetAsString(h, RPMTAG_NEVRA);
 	    rpmteAddDepProblem(te, pkgNEVRA, ds, NULL);
 	    free(pkgNEVRA);
@@ -889,7 +966,7 @@ static void checkInstDeps(rpmts ts, depCache dcache, rpmte te,
     free(ndep);
 }
 
-static void checkInstFileDeps(rpmts ts, depCache dcache, rpmte te,
+static void checkInstFileDeps(rpmts ts, depCache dcache, richCache rcache, rpmte te,
 			      rpmTag depTag, rpmfi fi, int is_not,
 			      filedepHash cache, fingerPrintCache *fpcp)
 {
@@ -922,7 +999,7 @@ static void checkInstFileDeps(rpmts ts, depCache dcache, rpmte te,
                              rpmstrPoolStr(pool, basename), NULL);
 	    dep = fpdep;
 	}
-	checkInstDeps(ts, dcache, te, depTag, dep, NULL, is_not);
+	checkInstDeps(ts, dcache, rcache, te, depTag, dep, NULL, is_not);
 	_free(fpdep);
     }
     _free(fp);
@@ -997,6 +1074,7 @@ int rpmtsCheck(rpmts ts)
     int closeatexit = 0;
     int rc = 0;
     depCache dcache = NULL;
+    richCache rcache = NULL;
     filedepHash confilehash = NULL;	/* file conflicts of installed packages */
     filedepHash connotfilehash = NULL;	/* file conflicts of installed packages */
     depexistsHash connothash = NULL;
@@ -1023,6 +1101,7 @@ int rpmtsCheck(rpmts ts)
     /* XXX FIXME: figure some kind of heuristic for the cache size */
     dcache = depCacheCreate(5001, rstrhash, strcmp,
 				     (depCacheFreeKey)rfree, NULL);
+    rcache = richCacheCreate(257, richDepHash, richDepCmp, richDepFree);
 
     /* build hashes of all confilict sdependencies */
     confilehash = filedepHashCreate(257, sidHash, sidCmp, NULL, NULL);
@@ -1059,11 +1138,11 @@ int rpmtsCheck(rpmts ts)
 	rpmlog(RPMLOG_DEBUG, "========== +++ %s %s/%s 0x%x\n",
 		rpmteNEVR(p), rpmteA(p), rpmteO(p), rpmteColor(p));
 
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_REQUIRENAME),
+	checkDS(ts, dcache, rcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_REQUIRENAME),
 		tscolor);
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_CONFLICTNAME),
+	checkDS(ts, dcache, rcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_CONFLICTNAME),
 		tscolor);
-	checkDS(ts, dcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_OBSOLETENAME),
+	checkDS(ts, dcache, rcache, p, rpmteNEVRA(p), rpmteDS(p, RPMTAG_OBSOLETENAME),
 		tscolor);
 
 	/* Skip obsoletion and provides checks for source packages (ie build) */
@@ -1072,13 +1151,13 @@ int rpmtsCheck(rpmts ts)
 
 	/* Check provides against conflicts in installed packages. */
 	while (rpmdsNext(provides) >= 0) {
-	    checkInstDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, NULL, provides, 0);
+	    checkInstDeps(ts, dcache, rcache, p, RPMTAG_CONFLICTNAME, NULL, provides, 0);
 	    if (reqnothash && depexistsHashHasEntry(reqnothash, rpmdsNId(provides)))
-		checkInstDeps(ts, dcache, p, RPMTAG_REQUIRENAME, NULL, provides, 1);
+		checkInstDeps(ts, dcache, rcache, p, RPMTAG_REQUIRENAME, NULL, provides, 1);
 	}
 
 	/* Check package name (not provides!) against installed obsoletes */
-	checkInstDeps(ts, dcache, p, RPMTAG_OBSOLETENAME, NULL, rpmteDS(p, RPMTAG_NAME), 0);
+	checkInstDeps(ts, dcache, rcache, p, RPMTAG_OBSOLETENAME, NULL, rpmteDS(p, RPMTAG_NAME), 0);
 
 	/* Check filenames against installed conflicts */
         if (confilehash || reqnotfilehash) {
@@ -1086,9 +1165,9 @@ int rpmtsCheck(rpmts ts)
 	    rpmfi fi = rpmfilesIter(files, RPMFI_ITER_FWD);
 	    while (rpmfiNext(fi) >= 0) {
 		if (confilehash)
-		    checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 0, confilehash, &fpc);
+		    checkInstFileDeps(ts, dcache, rcache, p, RPMTAG_CONFLICTNAME, fi, 0, confilehash, &fpc);
 		if (reqnotfilehash)
-		    checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 1, reqnotfilehash, &fpc);
+		    checkInstFileDeps(ts, dcache, rcache, p, RPMTAG_REQUIRENAME, fi, 1, reqnotfilehash, &fpc);
 	    }
 	    rpmfiFree(fi);
 	    rpmfilesFree(files);
@@ -1108,9 +1187,9 @@ int rpmtsCheck(rpmts ts)
 
 	/* Check provides and filenames against installed dependencies. */
 	while (rpmdsNext(provides) >= 0) {
-	    checkInstDeps(ts, dcache, p, RPMTAG_REQUIRENAME, NULL, provides, 0);
+	    checkInstDeps(ts, dcache, rcache, p, RPMTAG_REQUIRENAME, NULL, provides, 0);
 	    if (connothash && depexistsHashHasEntry(connothash, rpmdsNId(provides)))
-		checkInstDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, NULL, provides, 1);
+		checkInstDeps(ts, dcache, rcache, p, RPMTAG_CONFLICTNAME, NULL, provides, 1);
 	}
 
 	if (reqfilehash || connotfilehash) {
@@ -1119,9 +1198,9 @@ int rpmtsCheck(rpmts ts)
 	    while (rpmfiNext(fi) >= 0) {
 		if (RPMFILE_IS_INSTALLED(rpmfiFState(fi))) {
 		    if (reqfilehash)
-			checkInstFileDeps(ts, dcache, p, RPMTAG_REQUIRENAME, fi, 0, reqfilehash, &fpc);
+			checkInstFileDeps(ts, dcache, rcache, p, RPMTAG_REQUIRENAME, fi, 0, reqfilehash, &fpc);
 		    if (connotfilehash)
-			checkInstFileDeps(ts, dcache, p, RPMTAG_CONFLICTNAME, fi, 1, connotfilehash, &fpc);
+			checkInstFileDeps(ts, dcache, rcache, p, RPMTAG_CONFLICTNAME, fi, 1, connotfilehash, &fpc);
 		}
 	    }
 	    rpmfiFree(fi);
@@ -1135,6 +1214,7 @@ int rpmtsCheck(rpmts ts)
 
 exit:
     depCacheFree(dcache);
+    richCacheFree(rcache);
     filedepHashFree(confilehash);
     filedepHashFree(connotfilehash);
     depexistsHashFree(connothash);
@@ -30,6 +30,17 @@
 #define	_FSM_DEBUG	0
 int _fsm_debug = _FSM_DEBUG;
 
+/* Filesystem call and byte counters of the element being worked on */
+static __thread rpmop fsmop = NULL;
+
+static void fsmCount(size_t bytes)
+{
+    if (fsmop) {
+	fsmop->count++;
+	fsmop->bytes += bytes;
+    }
+}
+
 /* XXX Failure to remove is not (yet) cause for failure. */
 static int strict_erasures = 0;
 
@@ -85,6 +96,7 @@ static int fsmLink(int odirfd, const char *opath, int dirfd, const char *path)
 {
     int rc = linkat(odirfd, opath, dirfd, path, 0);
 
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s, %d %s) %s\n", __func__,
 	       odirfd, opath, dirfd, path, (rc < 0 ? strerror(errno) : ""));
@@ -124,6 +136,7 @@ static int fsmSetFCaps(int fd, int dirfd, const char *path, const char *captxt)
 		rc = RPMERR_SETCAP_FAILED;
 	}
 
+	fsmCount(0);
 	if (_fsm_debug) {
 	    rpmlog(RPMLOG_DEBUG, " %8s (%d - %d %s, %s) %s\n", __func__,
 		   fd, dirfd, path, captxt, (rc < 0 ? strerror(errno) : ""));
@@ -152,6 +165,7 @@ static int fsmClose(int *wfdp)
 	}
 	if (close(fdno))
 	    rc = RPMERR_CLOSE_FAILED;
+	fsmCount(0);
 
 	if (_fsm_debug) {
 	    rpmlog(RPMLOG_DEBUG, " %8s ([%d]) %s\n", __func__,
@@ -172,6 +186,7 @@ static int fsmOpen(int *wfdp, int dirfd, const char *dest)
     if (fd < 0)
 	rc = RPMERR_OPEN_FAILED;
 
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%s [%d]) %s\n", __func__,
 	       dest, fd, (rc < 0 ? strerror(errno) : ""));
@@ -185,6 +200,7 @@ static int fsmUnpack(rpmfi fi, int fdno, rpmpsm psm, int nodigest)
 {
     FD_t fd = fdDup(fdno);
     int rc = rpmfiArchiveReadToFilePsm(fi, fd, nodigest, psm);
+    fsmCount(rpmfiFSize(fi));
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%s %" PRIu64 " bytes [%d]) %s\n", __func__,
 	       rpmfiFN(fi), rpmfiFSize(fi), Fileno(fd),
@@ -242,6 +258,7 @@ static int fsmReadLink(const char *path,
     ssize_t llen = readlink(path, buf, bufsize - 1);
     int rc = RPMERR_READLINK_FAILED;
 
+    fsmCount(0);
     if (_fsm_debug) {
         rpmlog(RPMLOG_DEBUG, " %8s (%s, buf, %d) %s\n",
 	       __func__,
@@ -261,6 +278,7 @@ static int fsmStat(int dirfd, const char *path, int dolstat, struct stat *sb)
     int flags = dolstat ? AT_SYMLINK_NOFOLLOW : 0;
     int rc = fstatat(dirfd, path, sb, flags);
 
+    fsmCount(0);
     if (_fsm_debug && rc && errno != ENOENT)
         rpmlog(RPMLOG_DEBUG, " %8s (%d %s, ost) %s\n",
                __func__,
@@ -276,6 +294,7 @@ static int fsmStat(int dirfd, const char *path, int dolstat, struct stat *sb)
 static int fsmRmdir(int dirfd, const char *path)
 {
     int rc = unlinkat(dirfd, path, AT_REMOVEDIR);
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s) %s\n", __func__,
 	       dirfd, path, (rc < 0 ? strerror(errno) : ""));
@@ -291,6 +310,7 @@ static int fsmRmdir(int dirfd, const char *path)
 static int fsmMkdir(int dirfd, const char *path, mode_t mode)
 {
     int rc = mkdirat(dirfd, path, (mode & 07777));
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s, 0%04o) %s\n", __func__,
 	       dirfd, path, (unsigned)(mode & 07777),
@@ -306,6 +326,7 @@ static int fsmOpenat(int *wfdp, int dirfd, const char *path, int flags, int dir)
     int fd = openat(dirfd, path, sflags);
     int rc = 0;
 
+    fsmCount(0);
     /*
      * Only ever follow symlinks by root or target owner. Since we can't
      * open the symlink itself, the order matters: we stat the link *after*
@@ -440,6 +461,7 @@ static int fsmMkfifo(int dirfd, const char *path, mode_t mode)
 {
     int rc = mkfifoat(dirfd, path, (mode & 07777));
 
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s, 0%04o) %s\n",
 	       __func__, dirfd, path, (unsigned)(mode & 07777),
@@ -457,6 +479,7 @@ static int fsmMknod(int dirfd, const char *path, mode_t mode, dev_t dev)
     /* FIX: check S_IFIFO or dev != 0 */
     int rc = mknodat(dirfd, path, (mode & ~07777), dev);
 
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s, 0%o, 0x%x) %s\n",
 	       __func__, dirfd, path, (unsigned)(mode & ~07777),
@@ -502,6 +525,7 @@ static int fsmSymlink(const char *opath, int dirfd, const char *path)
 {
     int rc = symlinkat(opath, dirfd, path);
 
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%s, %d %s) %s\n", __func__,
 	       opath, dirfd, path, (rc < 0 ? strerror(errno) : ""));
@@ -517,6 +541,7 @@ static int fsmUnlink(int dirfd, const char *path)
     int rc = 0;
     removeSBITS(dirfd, path);
     rc = unlinkat(dirfd, path, 0);
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s) %s\n", __func__,
 	       dirfd, path, (rc < 0 ? strerror(errno) : ""));
@@ -540,6 +565,7 @@ static int fsmRename(int odirfd, const char *opath, int dirfd, const char *path)
 	free(rmpath);
     }
 #endif
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d %s, %d %s) %s\n", __func__,
 	       odirfd, opath, dirfd, path, (rc < 0 ? strerror(errno) : ""));
@@ -576,6 +602,7 @@ static int fsmChown(int fd, int dirfd, const char *path, mode_t mode, uid_t uid,
 	    }
 	}
     }
+    fsmCount(0);
     if (_fsm_debug) {
 	rpmlog(RPMLOG_DEBUG, " %8s (%d - %d %s, %d, %d) %s\n", __func__,
 	       fd, dirfd, path, (int)uid, (int)gid,
@@ -607,6 +634,7 @@ static int fsmChmod(int fd, int dirfd, const char *path, mode_t mode)
 	    }
 	}
     }
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d - %d %s, 0%04o) %s\n", __func__,
 	       fd, dirfd, path, (unsigned)(mode & 07777),
@@ -628,6 +656,7 @@ static int fsmUtime(int fd, int dirfd, const char *path, mode_t mode, time_t mti
     else
 	rc = utimensat(dirfd, path, stamps, AT_SYMLINK_NOFOLLOW);
     
+    fsmCount(0);
     if (_fsm_debug)
 	rpmlog(RPMLOG_DEBUG, " %8s (%d - %d %s, 0x%x) %s\n", __func__,
 	       fd, dirfd, path, (unsigned)mtime, (rc < 0 ? strerror(errno) : ""));
@@ -856,6 +885,20 @@ static int onChdir(rpmfi fi, void *data)
     return 0;
 }
 
+/* Account the filesystem calls from now on to the element */
+static void fsmStatStart(rpmte te, rpmop sw)
+{
+    fsmop = rpmteOp(te, RPMTE_OP_FSM);
+    (void) rpmswEnter(sw, 0);
+}
+
+static void fsmStatStop(rpmop sw)
+{
+    (void) rpmswExit(sw, 0);
+    fsmop->usecs += sw->usecs;
+    fsmop = NULL;
+}
+
 static rpmfi fsmIter(FD_t payload, rpmfiles files, rpmFileIter iter, void *data)
 {
     rpmfi fi;
@@ -878,6 +921,7 @@ static rpmfi fsmIterFini(rpmfi fi, struct diriter_s *di)
 int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
               rpmpsm psm, char ** failedFile)
 {
+    struct rpmop_s fsmsw = { 0 };
     FD_t payload = rpmtePayload(te);
     rpmfi fi = NULL;
     rpmfs fs = rpmteGetFileStates(te);
@@ -893,6 +937,8 @@ int rpmPackageFilesInstall(rpmts ts, rpmte te, rpmfiles files,
     struct filedata_s *firstlink = NULL;
     struct diriter_s di = { -1, -1 };
 
+    fsmStatStart(te, &fsmsw);
+
     /* transaction id used for temporary path suffix while installing */
     rasprintf(&tid, ";%08x", (unsigned)rpmtsGetTid(ts));
 
@@ -1104,6 +1150,8 @@ setmeta:
 
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_UNCOMPRESS), fdOp(payload, FDSTAT_READ));
     rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST), fdOp(payload, FDSTAT_DIGEST));
+    rpmswAdd(rpmteOp(te, RPMTE_OP_UNCOMPRESS), fdOp(payload, FDSTAT_READ));
+    rpmswAdd(rpmteOp(te, RPMTE_OP_DIGEST), fdOp(payload, FDSTAT_DIGEST));
 
 exit:
     fi = fsmIterFini(fi, &di);
@@ -1112,6 +1160,7 @@ exit:
     for (int i = 0; i < fc; i++)
 	free(fdata[i].fpath);
     free(fdata);
+    fsmStatStop(&fsmsw);
 
     return rc;
 }
@@ -1120,8 +1169,9 @@ exit:
 int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
               rpmpsm psm, char ** failedFile)
 {
+    struct rpmop_s fsmsw = { 0 };
     struct diriter_s di = { -1, -1 };
-    rpmfi fi = fsmIter(NULL, files, RPMFI_ITER_BACK, &di);
+    rpmfi fi = NULL;
     rpmfs fs = rpmteGetFileStates(te);
     rpmPlugins plugins = rpmtsPlugins(ts);
     int fc = rpmfilesFC(files);
@@ -1129,6 +1179,8 @@ int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
     struct filedata_s *fdata = (struct filedata_s *)xcalloc(fc, sizeof(*fdata));
     int rc = 0;
 
+    fsmStatStart(te, &fsmsw);
+    fi = fsmIter(NULL, files, RPMFI_ITER_BACK, &di);
     while (!rc && (fx = rpmfiNext(fi)) >= 0) {
 	struct filedata_s *fp = &fdata[fx];
 	fp->action = rpmfsGetAction(fs, rpmfiFX(fi));
@@ -1207,6 +1259,7 @@ int rpmPackageFilesRemove(rpmts ts, rpmte te, rpmfiles files,
 	free(fdata[i].fpath);
     free(fdata);
     fsmIterFini(fi, &di);
+    fsmStatStop(&fsmsw);
 
     return rc;
 }
@@ -14,6 +14,8 @@
 #include <inttypes.h>
 #include <rpm/rpmtypes.h>
 #include <rpm/rpmstring.h>
+#include <rpm/rpmbase64.h>
+#include <rpm/rpmlog.h>
 #include "header_internal.h"
 #include "misc.h"			/* tag function proto */
 
@@ -73,6 +75,9 @@ enum headerFlags_e {
     HEADERFLAG_ALLOCATED = (1 << 1), /*!< Is 1st header region allocated? */
     HEADERFLAG_LEGACY    = (1 << 2), /*!< Header came from legacy source? */
     HEADERFLAG_DEBUG     = (1 << 3), /*!< Debug this header? */
+    HEADERFLAG_LAZY      = (1 << 4), /*!< Entries decoded on first access? */
+    HEADERFLAG_BADENTRY  = (1 << 5), /*!< Lazy entry failed to decode? */
+    HEADERFLAG_ARENA     = (1 << 6), /*!< Tag data allocated from arena? */
 };
 
 typedef rpmFlags headerFlags;
@@ -95,7 +100,18 @@ struct indexEntry_s {
     struct entryInfo_s info;	/*!< Description of tag data. */
     void * data; 		/*!< Location of tag data. */
     uint32_t length;		/*!< No. bytes of data. */
-    uint32_t rdlen;		/*!< No. bytes of data in region. */
+    uint32_t rdlen;		/*!< No. bytes of data in region (or arena). */
+};
+
+/** \ingroup header
+ * A block of tag data memory, handed out in order and released at once.
+ */
+typedef struct headerArena_s * headerArena;
+struct headerArena_s {
+    headerArena next;		/*!< Previously filled block. */
+    size_t size;		/*!< No. bytes in block. */
+    size_t used;		/*!< No. bytes handed out. */
+    char data[];
 };
 
 /** \ingroup header
@@ -108,6 +124,7 @@ struct headerToken_s {
     int indexAlloced;		/*!< Allocated size of tag array. */
     unsigned int instance;	/*!< Rpmdb instance */
     headerFlags flags;
+    headerArena arena;		/*!< Tag data blocks (HEADERFLAG_ARENA) */
     int sorted;			/*!< Current sort method */
     int nrefs;			/*!< Reference count. */
 };
@@ -119,9 +136,14 @@ static const size_t headerMaxbytes = (256*1024*1024);
 
 #define	INDEX_MALLOC_SIZE	8
 
+#define	ARENA_BLOCK_MIN		(64 * 1024)
+#define	ARENA_BLOCK_MAX		(4 * 1024 * 1024)
+
 #define	ENTRY_IS_REGION(_e) \
 	(((_e)->info.tag >= RPMTAG_HEADERIMAGE) && ((_e)->info.tag < RPMTAG_HEADERREGIONS))
 #define	ENTRY_IN_REGION(_e)	((_e)->info.offset < 0)
+/* Lazily imported entry, rdlen is the space available for its data */
+#define	ENTRY_IS_LAZY(_e)	(ENTRY_IN_REGION(_e) && (_e)->length == 0)
 
 #define	REGION_TAG_TYPE		RPM_BIN_TYPE
 #define	REGION_TAG_COUNT	sizeof(struct entryInfo_s)
@@ -187,6 +209,8 @@ static inline void ei2h(const struct entryInfo_s *pe, struct entryInfo_s *info)
 static int dataLength(uint32_t type, const void * p, uint32_t count,
 			 int onDisk, const void * pend, uint32_t *length);
 
+static int headerUnlazy(Header h);
+
 void hdrblobDigestUpdate(rpmDigestBundle bundle, struct hdrblob_s *blob)
 {
     uint32_t ildl[2] = { htonl(blob->ril), htonl(blob->rdl) };
@@ -246,6 +270,42 @@ static Header headerUnlink(Header h)
     return NULL;
 }
 
+/* Return 8 byte aligned tag data space, valid until headerFree() */
+static void * arenaAlloc(Header h, size_t size)
+{
+    headerArena a = h->arena;
+    void * p;
+
+    size = (size + 7) & ~((size_t) 7);
+    if (a == NULL || a->size - a->used < size) {
+	size_t bsize = a ? a->size * 2 : ARENA_BLOCK_MIN;
+	if (bsize > ARENA_BLOCK_MAX)
+	    bsize = ARENA_BLOCK_MAX;
+	if (bsize < size)
+	    bsize = size;
+	a = (headerArena)xmalloc(sizeof(*a) + bsize);
+	a->next = h->arena;
+	a->size = bsize;
+	a->used = 0;
+	h->arena = a;
+    }
+    p = a->data + a->used;
+    a->used += size;
+    return p;
+}
+
+static void * entryAlloc(Header h, size_t size)
+{
+    return (h->flags & HEADERFLAG_ARENA) ? arenaAlloc(h, size) : xmalloc(size);
+}
+
+/* Arena space is only released with the header */
+static void entryFree(Header h, void * data)
+{
+    if (!(h->flags & HEADERFLAG_ARENA))
+	free(data);
+}
+
 Header headerFree(Header h)
 {
     (void) headerUnlink(h);
@@ -264,7 +324,7 @@ Header headerFree(Header h)
 		    entry->data = NULL;
 		}
 	    } else if (!ENTRY_IN_REGION(entry)) {
-		entry->data = _free(entry->data);
+		entryFree(h, entry->data);
 	    }
 	    entry->data = NULL;
 	}
@@ -272,6 +332,12 @@ Header headerFree(Header h)
     }
     h->blob = _free(h->blob);
 
+    while (h->arena) {
+	headerArena a = h->arena;
+	h->arena = a->next;
+	free(a);
+    }
+
     h = _free(h);
     return NULL;
 }
@@ -300,7 +366,22 @@ Header headerNew(void)
     return headerCreate(NULL, 0);
 }
 
-static int hdrblobVerifyInfo(hdrblob blob, char **emsg)
+Header headerNewWithFlags(headerNewFlags flags)
+{
+    Header h = headerCreate(NULL, 0);
+    if (flags & HEADERNEW_ARENA)
+	h->flags |= HEADERFLAG_ARENA;
+    return h;
+}
+
+/* Can the blob entries be decoded on first access? */
+static int hdrblobIsLazy(hdrblob blob, headerImportFlags flags)
+{
+    return ((flags & HEADERIMPORT_LAZY) && blob->regionTag &&
+	    blob->pe->offset != 0);
+}
+
+static int hdrblobVerifyInfo(hdrblob blob, int lazy, char **emsg)
 {
     struct entryInfo_s info;
     uint32_t i, len = 0;
@@ -334,8 +415,10 @@ static int hdrblobVerifyInfo(hdrblob blob, char **emsg)
 	if (typechk && hdrchkTagType(info.tag, info.type))
 	    goto err;
 
-	/* Verify the data actually fits */
-	if (dataLength(info.type, ds + info.offset,
+	/* Verify the data actually fits, lazily on first access if enabled */
+	if (lazy) {
+	    len = 1;
+	} else if (dataLength(info.type, ds + info.offset,
 			 info.count, 1, ds + blob->dl, &len)) {
 	    goto err;
 	}
@@ -414,6 +497,7 @@ unsigned headerSizeof(Header h, int magicp)
 	return size;
 
     headerSort(h);
+    (void) headerUnlazy(h);
 
     if (magicp == HEADER_MAGIC_YES)
 	size += sizeof(rpm_header_magic);
@@ -637,6 +721,111 @@ static int regionSwab(indexEntry entry, uint32_t il, uint32_t dl,
     return 0;
 }
 
+/**
+ * Set up header entries for lazy decoding.
+ * Only the entry info is checked here, the data is checked and swabbed
+ * by entryDecode() when the entry is first accessed. The data of an
+ * entry must end where the next one starts, or at the end of the range.
+ *
+ * @param entry		header entry
+ * @param il		no. of entries
+ * @param pe		header physical entry pointer (swapped)
+ * @param dataStart	header data start
+ * @param start		start of data range
+ * @param end		end of data range
+ * @param regionid	region offset
+ * @return		0 on success, -1 on error
+ */
+static int regionIndex(indexEntry entry, uint32_t il, entryInfo pe,
+		unsigned char * dataStart, uint32_t start, uint32_t end,
+		int regionid)
+{
+    for (; il > 0; il--, pe++, entry++) {
+	uint32_t next = (il > 1) ? ntohl(pe[1].offset) : end;
+	uint32_t offset;
+
+	ei2h(pe, &entry->info);
+	offset = entry->info.offset;
+
+	if (hdrchkType(entry->info.type))
+	    return -1;
+	if (hdrchkData(entry->info.count))
+	    return -1;
+	if (hdrchkData(offset))
+	    return -1;
+	if (hdrchkAlign(entry->info.type, offset))
+	    return -1;
+	if (offset < start || next > end || next <= offset)
+	    return -1;
+
+	entry->data = dataStart + offset;
+	entry->length = 0;
+	entry->rdlen = next - offset;
+	entry->info.offset = regionid;
+    }
+    return 0;
+}
+
+/**
+ * Check and swab the data of a lazily imported entry.
+ * @param h		header
+ * @param entry		header entry
+ * @return		0 on success, -1 on error
+ */
+static int entryDecode(Header h, indexEntry entry)
+{
+    const char * end = (const char *)entry->data + entry->rdlen;
+    uint32_t count = entry->info.count;
+    uint32_t length = 0;
+
+    if (dataLength(entry->info.type, entry->data, count, 1, end, &length) ||
+		length == 0 || hdrchkData(length)) {
+	/* Damage must not pass for a missing tag, always tell about it */
+	rpmlog(RPMLOG_ERR, _("damaged tag %s (%d) in header #%u\n"),
+		rpmTagGetName(entry->info.tag), entry->info.tag, h->instance);
+	/* Such a header can no longer be exported */
+	h->flags |= HEADERFLAG_BADENTRY;
+	return -1;
+    }
+
+    /* Perform endian conversions, the data is known to fit now */
+    switch (entry->info.type) {
+    case RPM_INT64_TYPE:
+    {   uint64_t * it = (uint64_t *)entry->data;
+	for (; count > 0; count--, it++)
+	    *it = htonll(*it);
+    }   break;
+    case RPM_INT32_TYPE:
+    {   uint32_t * it = (uint32_t *)entry->data;
+	for (; count > 0; count--, it++)
+	    *it = htonl(*it);
+    }   break;
+    case RPM_INT16_TYPE:
+    {   uint16_t * it = (uint16_t *)entry->data;
+	for (; count > 0; count--, it++)
+	    *it = htons(*it);
+    }   break;
+    }
+
+    entry->length = length;
+    entry->rdlen = 0;
+    return 0;
+}
+
+/* Decode all remaining lazy entries, return -1 if some are broken */
+static int headerUnlazy(Header h)
+{
+    if (h->flags & HEADERFLAG_LAZY) {
+	for (int i = 0; i < h->indexUsed; i++) {
+	    indexEntry entry = h->index + i;
+	    if (ENTRY_IS_LAZY(entry))
+		(void) entryDecode(h, entry);
+	}
+	h->flags &= ~HEADERFLAG_LAZY;
+    }
+    return (h->flags & HEADERFLAG_BADENTRY) ? -1 : 0;
+}
+
 static void * doExport(const struct indexEntry_s *hindex, int indexUsed,
 			headerFlags flags, unsigned int *bsize)
 {
@@ -866,7 +1055,8 @@ void * headerExport(Header h, unsigned int *bsize)
 {
     void *blob = NULL;
 
-    if (h) {
+    /* Region data is exported as is, all of it must be in host order */
+    if (h && headerUnlazy(h) == 0) {
 	blob = doExport(h->index, h->indexUsed, h->flags, bsize);
     }
 
@@ -908,6 +1098,23 @@ indexEntry findEntry(Header h, rpmTagVal tag, uint32_t type)
     return NULL;
 }
 
+/**
+ * Find matching (tag,type) entry in header, with its data decoded.
+ * @param h		header
+ * @param tag		entry tag
+ * @param type		entry type
+ * @return 		header entry
+ */
+static
+indexEntry getEntry(Header h, rpmTagVal tag, uint32_t type)
+{
+    indexEntry entry = findEntry(h, tag, type);
+
+    if (entry && ENTRY_IS_LAZY(entry) && entryDecode(h, entry))
+	return NULL;
+    return entry;
+}
+
 int headerDel(Header h, rpmTagVal tag)
 {
     indexEntry last = h->index + h->indexUsed;
@@ -926,12 +1133,15 @@ int headerDel(Header h, rpmTagVal tag)
 	void * data;
 	if (first->info.tag != tag)
 	    break;
+	/* Deleted region entries are still exported, in host order */
+	if (ENTRY_IS_LAZY(first))
+	    (void) entryDecode(h, first);
 	data = first->data;
 	first->data = NULL;
 	first->length = 0;
 	if (ENTRY_IN_REGION(first))
 	    continue;
-	free(data);
+	entryFree(h, data);
     }
 
     ne = (first - entry);
@@ -945,11 +1155,14 @@ int headerDel(Header h, rpmTagVal tag)
     return 0;
 }
 
-rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
+rpmRC hdrblobImport(hdrblob blob, headerImportFlags flags,
+		     Header *hdrp, char **emsg)
 {
     Header h = NULL;
     indexEntry entry; 
     uint32_t rdlen;
+    int fast = (flags & HEADERIMPORT_FAST);
+    int lazy = hdrblobIsLazy(blob, flags);
 
     h = headerCreate(blob->ei, blob->il);
 
@@ -987,7 +1200,15 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
 	entry->info.offset = -offset; /* negative offset */
 	entry->data = blob->pe;
 	entry->length = blob->pvlen - sizeof(blob->il) - sizeof(blob->dl);
-	if (regionSwab(entry+1, ril-1, 0, blob->pe+1,
+	if (lazy) {
+	    /* Region data ends at the trailer */
+	    rdlen = blob->rdl - REGION_TAG_COUNT;
+	    if (regionIndex(entry+1, ril-1, blob->pe+1, blob->dataStart,
+			    0, rdlen, entry->info.offset)) {
+		goto errxit;
+	    }
+	    h->flags |= HEADERFLAG_LAZY;
+	} else if (regionSwab(entry+1, ril-1, 0, blob->pe+1,
 			   blob->dataStart, blob->dataEnd,
 			   entry->info.offset, fast, &rdlen)) {
 	    goto errxit;
@@ -1000,7 +1221,14 @@ rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg)
 	    int rid = entry->info.offset+1;
 
 	    /* Load dribble entries from region. */
-	    if (regionSwab(newEntry, ne, rdlen, blob->pe+ril,
+	    if (lazy) {
+		/* Dribble data follows the trailer */
+		if (regionIndex(newEntry, ne, blob->pe+ril, blob->dataStart,
+				blob->rdl, blob->dl, rid)) {
+		    goto errxit;
+		}
+		rdlen = blob->dl - REGION_TAG_COUNT;
+	    } else if (regionSwab(newEntry, ne, rdlen, blob->pe+ril,
 			blob->dataStart, blob->dataEnd, rid, fast, &rdlen)) {
 		goto errxit;
 	    }
@@ -1110,9 +1338,12 @@ exit:
 
 int headerIsEntry(Header h, rpmTagVal tag)
 {
-   		/* FIX: h modified by sort. */
-    return (findEntry(h, tag, RPM_NULL_TYPE) ? 1 : 0);
-   	
+    /* Entries whose lazy data fails to decode can't be retrieved either */
+    indexEntry entry = getEntry(h, tag, RPM_NULL_TYPE);
+
+    if (entry && ENTRY_IS_REGION(entry) && headerUnlazy(h))
+	entry = NULL;
+    return (entry ? 1 : 0);
 }
 
 /* simple heuristic to find out if the header is from * a source rpm
@@ -1121,7 +1352,7 @@ int headerIsEntry(Header h, rpmTagVal tag)
  */
 int headerIsSourceHeuristic(Header h)
 {
-    indexEntry entry = findEntry(h, RPMTAG_DIRNAMES, RPM_STRING_ARRAY_TYPE);
+    indexEntry entry = getEntry(h, RPMTAG_DIRNAMES, RPM_STRING_ARRAY_TYPE);
     return entry && entry->info.count == 1 && entry->data && !*(const char *)entry->data;
 }
 
@@ -1333,7 +1564,7 @@ static int copyI18NEntry(Header h, indexEntry entry, rpmtd td,
 	(lang = getenv("LANG")) == NULL)
 	    goto exit;
     
-    if ((table = findEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE)) == NULL)
+    if ((table = getEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE)) == NULL)
 	goto exit;
 
     for (l = lang; *l != '\0'; l = le) {
@@ -1390,13 +1621,16 @@ static int intGetTdEntry(Header h, rpmtd td, headerGetFlags flags)
 
     /* First find the tag */
     /* FIX: h modified by sort. */
-    entry = findEntry(h, td->tag, RPM_NULL_TYPE);
+    entry = getEntry(h, td->tag, RPM_NULL_TYPE);
     if (entry == NULL) {
 	/* Td is zeroed above, just return... */
 	return 0;
     }
 
-    if (entry->info.type == RPM_I18NSTRING_TYPE && !(flags & HEADERGET_RAW))
+    /* Region data is copied as is, all of it must be in host order */
+    if (ENTRY_IS_REGION(entry) && headerUnlazy(h))
+	rc = 0;
+    else if (entry->info.type == RPM_I18NSTRING_TYPE && !(flags & HEADERGET_RAW))
 	rc = copyI18NEntry(h, entry, td, flags);
     else
 	rc = copyTdEntry(entry, td, flags);
@@ -1456,7 +1690,8 @@ static void copyData(uint32_t type, void * dstPtr,
 }
 
 /**
- * Return (malloc'ed) copy of entry data.
+ * Return (malloc'ed or arena) copy of entry data.
+ * @param h		header
  * @param type		entry data type
  * @param p		entry data
  * @param c		entry item count
@@ -1464,7 +1699,8 @@ static void copyData(uint32_t type, void * dstPtr,
  * @return 		(malloc'ed) copy of entry data, NULL on error
  */
 static void *
-grabData(uint32_t type, const void * p, uint32_t c, uint32_t * lengthPtr)
+grabData(Header h, uint32_t type, const void * p, uint32_t c,
+	 uint32_t * lengthPtr)
 {
     void * data = NULL;
     uint32_t length;
@@ -1473,7 +1709,7 @@ grabData(uint32_t type, const void * p, uint32_t c, uint32_t * lengthPtr)
 	return NULL;
 
     if (length > 0) {
-	data = xmalloc(length);
+	data = entryAlloc(h, length);
 	copyData(type, data, p, c, length);
     }
 
@@ -1499,7 +1735,7 @@ static int intAddEntry(Header h, rpmtd td)
     if (hdrchkArray(td->type, td->count))
 	return 0;
 
-    data = grabData(td->type, td->data, td->count, &length);
+    data = grabData(h, td->type, td->data, td->count, &length);
     if (data == NULL)
 	return 0;
 
@@ -1517,6 +1753,7 @@ static int intAddEntry(Header h, rpmtd td)
     entry->info.offset = 0;
     entry->data = data;
     entry->length = length;
+    entry->rdlen = 0;
 
     if (h->indexUsed > 0 && td->tag < h->index[h->indexUsed-1].info.tag)
 	h->sorted = 0;
@@ -1525,6 +1762,28 @@ static int intAddEntry(Header h, rpmtd td)
     return 1;
 }
 
+/* Make room for length more bytes after the entry data */
+static void entryGrow(Header h, indexEntry entry, uint32_t length)
+{
+    if (h->flags & HEADERFLAG_ARENA) {
+	/* Grow geometrically, the space of outgrown copies isn't reused */
+	if (ENTRY_IN_REGION(entry) || entry->length + length > entry->rdlen) {
+	    uint32_t alloced = 2 * (entry->length + length);
+	    char * t = (char *)arenaAlloc(h, alloced);
+	    memcpy(t, entry->data, entry->length);
+	    entry->data = t;
+	    entry->rdlen = alloced;
+	    entry->info.offset = 0;
+	}
+    } else if (ENTRY_IN_REGION(entry)) {
+	char * t = (char *)xmalloc(entry->length + length);
+	memcpy(t, entry->data, entry->length);
+	entry->data = t;
+	entry->info.offset = 0;
+    } else
+	entry->data = xrealloc(entry->data, entry->length + length);
+}
+
 static int intAppendEntry(Header h, rpmtd td)
 {
     indexEntry entry;
@@ -1536,20 +1795,14 @@ static int intAppendEntry(Header h, rpmtd td)
     }
 
     /* Find the tag entry in the header. */
-    entry = findEntry(h, td->tag, td->type);
+    entry = getEntry(h, td->tag, td->type);
     if (!entry)
 	return 0;
 
     if (dataLength(td->type, td->data, td->count, 0, NULL, &length))
 	return 0;
 
-    if (ENTRY_IN_REGION(entry)) {
-	char * t = (char *)xmalloc(entry->length + length);
-	memcpy(t, entry->data, entry->length);
-	entry->data = t;
-	entry->info.offset = 0;
-    } else
-	entry->data = xrealloc(entry->data, entry->length + length);
+    entryGrow(h, entry, length);
 
     copyData(td->type, ((char *) entry->data) + entry->length, 
 	     td->data, td->count, length);
@@ -1586,8 +1839,8 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
     uint32_t i, langNum;
     char * buf;
 
-    table = findEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE);
-    entry = findEntry(h, tag, RPM_I18NSTRING_TYPE);
+    table = getEntry(h, RPMTAG_HEADERI18NTABLE, RPM_STRING_ARRAY_TYPE);
+    entry = getEntry(h, tag, RPM_I18NSTRING_TYPE);
 
     if (!table && entry)
 	return 0;		/* this shouldn't ever happen!! */
@@ -1626,13 +1879,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 
     if (langNum >= table->info.count) {
 	length = strlen(lang) + 1;
-	if (ENTRY_IN_REGION(table)) {
-	    char * t = (char *)xmalloc(table->length + length);
-	    memcpy(t, table->data, table->length);
-	    table->data = t;
-	    table->info.offset = 0;
-	} else
-	    table->data = xrealloc(table->data, table->length + length);
+	entryGrow(h, table, length);
 	memmove(((char *)table->data) + table->length, lang, length);
 	table->length += length;
 	table->info.count++;
@@ -1658,13 +1905,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 	ghosts = langNum - entry->info.count;
 	
 	length = strlen(string) + 1 + ghosts;
-	if (ENTRY_IN_REGION(entry)) {
-	    char * t = (char *)xmalloc(entry->length + length);
-	    memcpy(t, entry->data, entry->length);
-	    entry->data = t;
-	    entry->info.offset = 0;
-	} else
-	    entry->data = xrealloc(entry->data, entry->length + length);
+	entryGrow(h, entry, length);
 
 	memset(((char *)entry->data) + entry->length, '\0', ghosts);
 	memmove(((char *)entry->data) + entry->length + ghosts, string, strlen(string)+1);
@@ -1690,7 +1931,7 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 	sn = strlen(string) + 1;
 	en = (ee-e);
 	length = bn + sn + en;
-	t = buf = (char *)xmalloc(length);
+	t = buf = (char *)entryAlloc(h, length);
 
 	/* Copy values into new storage */
 	memcpy(t, b, bn);
@@ -1707,8 +1948,9 @@ int headerAddI18NString(Header h, rpmTagVal tag, const char * string,
 	if (ENTRY_IN_REGION(entry)) {
 	    entry->info.offset = 0;
 	} else
-	    entry->data = _free(entry->data);
+	    entryFree(h, entry->data);
 	entry->data = buf;
+	entry->rdlen = 0;
     }
 
     return 0;
@@ -1726,7 +1968,7 @@ int headerMod(Header h, rpmtd td)
     if (!entry)
 	return 0;
 
-    data = grabData(td->type, td->data, td->count, &length);
+    data = grabData(h, td->type, td->data, td->count, &length);
     if (data == NULL)
 	return 0;
 
@@ -1734,6 +1976,12 @@ int headerMod(Header h, rpmtd td)
     while (entry > h->index && (entry - 1)->info.tag == td->tag)  
 	entry--;
 
+    /* The old data stays in the region, in host order like the rest */
+    if (ENTRY_IS_LAZY(entry) && entryDecode(h, entry)) {
+	entryFree(h, data);
+	return 0;
+    }
+
     /* free after we've grabbed the new data in case the two are intertwined;
        that's a bad idea but at least we won't break */
     oldData = entry->data;
@@ -1742,11 +1990,12 @@ int headerMod(Header h, rpmtd td)
     entry->info.type = td->type;
     entry->data = data;
     entry->length = length;
+    entry->rdlen = 0;
 
     if (ENTRY_IN_REGION(entry)) {
 	entry->info.offset = 0;
     } else
-	free(oldData);
+	entryFree(h, oldData);
 
     return 1;
 }
@@ -1787,8 +2036,12 @@ static indexEntry nextIndex(HeaderIterator hi)
 
     for (slot = hi->next_index; slot < h->indexUsed; slot++) {
 	entry = h->index + slot;
-	if (!ENTRY_IS_REGION(entry))
-	    break;
+	if (ENTRY_IS_REGION(entry))
+	    continue;
+	/* Skip entries with broken data */
+	if (ENTRY_IS_LAZY(entry) && entryDecode(h, entry))
+	    continue;
+	break;
     }
     hi->next_index = slot;
     if (entry == NULL || slot >= h->indexUsed)
@@ -1817,6 +2070,157 @@ int headerNext(HeaderIterator hi, rpmtd td)
     return ((rc == 1) ? 1 : 0);
 }
 
+/* Growable output buffer for headerJSON() */
+struct jsonBuf_s {
+    char *buf;
+    size_t len;
+    size_t alloced;
+};
+
+static char *jsonReserve(struct jsonBuf_s *jb, size_t need)
+{
+    if (jb->len + need + 1 > jb->alloced) {
+	while (jb->len + need + 1 > jb->alloced)
+	    jb->alloced *= 2;
+	jb->buf = xrealloc(jb->buf, jb->alloced);
+    }
+    return jb->buf + jb->len;
+}
+
+static void jsonAppend(struct jsonBuf_s *jb, const char *s, size_t len)
+{
+    memcpy(jsonReserve(jb, len), s, len);
+    jb->len += len;
+}
+
+static void jsonString(struct jsonBuf_s *jb, const char *s)
+{
+    /* Characters needing an escape, everything else is copied in bulk */
+    static const char reject[] =
+	"\"\\\001\002\003\004\005\006\007\010\011\012\013\014\015\016\017"
+	"\020\021\022\023\024\025\026\027\030\031\032\033\034\035\036\037";
+
+    jsonAppend(jb, "\"", 1);
+    while (*s) {
+	size_t n = strcspn(s, reject);
+	jsonAppend(jb, s, n);
+	s += n;
+	if (*s) {
+	    char esc[8];
+	    switch (*s) {
+	    case '"':	strcpy(esc, "\\\"");	break;
+	    case '\\':	strcpy(esc, "\\\\");	break;
+	    case '\b':	strcpy(esc, "\\b");	break;
+	    case '\f':	strcpy(esc, "\\f");	break;
+	    case '\n':	strcpy(esc, "\\n");	break;
+	    case '\r':	strcpy(esc, "\\r");	break;
+	    case '\t':	strcpy(esc, "\\t");	break;
+	    default:
+		snprintf(esc, sizeof(esc), "\\u%04x", *s);
+		break;
+	    }
+	    jsonAppend(jb, esc, strlen(esc));
+	    s++;
+	}
+    }
+    jsonAppend(jb, "\"", 1);
+}
+
+static void jsonNumber(struct jsonBuf_s *jb, uint64_t num)
+{
+    /* 20 digits are enough for any 64bit number */
+    jb->len += sprintf(jsonReserve(jb, 20), "%" PRIu64, num);
+}
+
+/* Format one tag the way the :json query format does */
+static void jsonEntry(struct jsonBuf_s *jb, indexEntry entry)
+{
+    const char *name = rpmTagGetName(entry->info.tag);
+    uint32_t count = entry->info.count;
+    int array = (count > 1 && entry->info.type != RPM_BIN_TYPE);
+    const char *str = entry->data;
+
+    if (jb->len > 1)
+	jsonAppend(jb, ",", 1);
+    if (rstreq(name, "(unknown)")) {
+	jsonAppend(jb, "\"[", 2);
+	jsonNumber(jb, entry->info.tag);
+	jsonAppend(jb, "]\"", 2);
+    } else {
+	jsonString(jb, name);
+    }
+    jsonAppend(jb, array ? ":[" : ":", array ? 2 : 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+	if (i > 0)
+	    jsonAppend(jb, ",", 1);
+	switch (entry->info.type) {
+	case RPM_STRING_TYPE:
+	case RPM_STRING_ARRAY_TYPE:
+	case RPM_I18NSTRING_TYPE:
+	    jsonString(jb, str);
+	    str += strlen(str) + 1;
+	    break;
+	case RPM_CHAR_TYPE:
+	case RPM_INT8_TYPE:
+	    jsonNumber(jb, ((uint8_t *)entry->data)[i]);
+	    break;
+	case RPM_INT16_TYPE:
+	    jsonNumber(jb, ((uint16_t *)entry->data)[i]);
+	    break;
+	case RPM_INT32_TYPE:
+	    jsonNumber(jb, ((uint32_t *)entry->data)[i]);
+	    break;
+	case RPM_INT64_TYPE:
+	    jsonNumber(jb, ((uint64_t *)entry->data)[i]);
+	    break;
+	case RPM_BIN_TYPE: {
+	    char *b64 = rpmBase64Encode(entry->data, count, 0);
+	    jsonString(jb, b64 ? b64 : "");
+	    free(b64);
+	    i = count;
+	    break;
+	}
+	default:
+	    jsonAppend(jb, "null", 4);
+	    break;
+	}
+    }
+
+    if (array)
+	jsonAppend(jb, "]", 1);
+}
+
+char * headerJSON(Header h, const rpmTagVal * tags)
+{
+    struct jsonBuf_s jb = { NULL, 0, 4096 };
+
+    jb.buf = xmalloc(jb.alloced);
+    jsonAppend(&jb, "{", 1);
+
+    headerSort(h);
+    if (tags) {
+	for (const rpmTagVal *t = tags; *t; t++) {
+	    indexEntry entry = getEntry(h, *t, RPM_NULL_TYPE);
+	    if (entry && !ENTRY_IS_REGION(entry))
+		jsonEntry(&jb, entry);
+	}
+    } else {
+	for (int i = 0; i < h->indexUsed; i++) {
+	    indexEntry entry = h->index + i;
+	    if (ENTRY_IS_REGION(entry))
+		continue;
+	    if (ENTRY_IS_LAZY(entry) && entryDecode(h, entry))
+		continue;
+	    jsonEntry(&jb, entry);
+	}
+    }
+
+    jsonAppend(&jb, "}\n", 2);
+    jb.buf[jb.len] = '\0';
+    return jb.buf;
+}
+
 unsigned int headerGetInstance(Header h)
 {
     return h ? h->instance : 0;
@@ -2042,8 +2446,8 @@ exit:
     return rc;
 }
 
-rpmRC hdrblobInit(const void *uh, size_t uc,
-		rpmTagVal regionTag, int exact_size,
+static rpmRC doBlobInit(const void *uh, size_t uc,
+		rpmTagVal regionTag, int exact_size, headerImportFlags flags,
 		struct hdrblob_s *blob, char **emsg)
 {
     rpmRC rc = RPMRC_FAIL;
@@ -2076,7 +2480,7 @@ rpmRC hdrblobInit(const void *uh, size_t uc,
 	goto exit;
 
     /* Sanity check the rest of the header structure. */
-    if (hdrblobVerifyInfo(blob, emsg))
+    if (hdrblobVerifyInfo(blob, hdrblobIsLazy(blob, flags), emsg))
 	goto exit;
 
     rc = RPMRC_OK;
@@ -2085,6 +2489,13 @@ exit:
     return rc;
 }
 
+rpmRC hdrblobInit(const void *uh, size_t uc,
+		rpmTagVal regionTag, int exact_size,
+		struct hdrblob_s *blob, char **emsg)
+{
+    return doBlobInit(uh, uc, regionTag, exact_size, 0, blob, emsg);
+}
+
 rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td)
 {
     rpmRC rc = RPMRC_NOTFOUND;
@@ -2137,8 +2548,8 @@ Header headerImport(void * blob, unsigned int bsize, headerImportFlags flags)
     }
 
     /* Sanity checks on header intro. */
-    if (hdrblobInit(b, bsize, 0, 0, &hblob, &buf) == RPMRC_OK)
-	hdrblobImport(&hblob, (flags & HEADERIMPORT_FAST), &h, &buf);
+    if (doBlobInit(b, bsize, 0, 0, flags, &hblob, &buf) == RPMRC_OK)
+	hdrblobImport(&hblob, flags, &h, &buf);
 
 exit:
     if (h == NULL && b != blob)
@@ -39,7 +39,8 @@ RPM_GNUC_INTERNAL
 rpmRC hdrblobRead(FD_t fd, int magic, int exact_size, rpmTagVal regionTag, hdrblob blob, char **emsg);
 
 RPM_GNUC_INTERNAL
-rpmRC hdrblobImport(hdrblob blob, int fast, Header *hdrp, char **emsg);
+rpmRC hdrblobImport(hdrblob blob, headerImportFlags flags,
+		     Header *hdrp, char **emsg);
 
 RPM_GNUC_INTERNAL
 rpmRC hdrblobGet(hdrblob blob, uint32_t tag, rpmtd td);
@@ -95,10 +95,23 @@ struct headerSprintfArgs_s {
     size_t alloced;
     int numTokens;
     int i;
+    int iterate;
     headerGetFlags hgflags;
     struct xformat_s xfmt;
 };
 
+/**
+ * A parsed query format, for formatting any number of headers.
+ */
+struct headerQueryFormat_s {
+    char * fmt;			/*!< Format string, tokens point into it */
+    sprintfToken format;	/*!< Parsed format */
+    int numTokens;
+    int iterate;		/*!< Iterate over all tags ("[%{*...}]")? */
+    struct xformat_s xfmt;
+    tagCache cache;		/*!< Tag data of current header */
+};
+
 static char escapedChar(const char ch)	
 {
     switch (ch) {
@@ -158,18 +171,13 @@ freeFormat( sprintfToken format, int num)
  */
 static void hsaInit(headerSprintfArgs hsa)
 {
-    sprintfTag tag =
-	(hsa->format->type == PTOK_TAG
-	    ? &hsa->format->u.tag :
-	(hsa->format->type == PTOK_ARRAY
-	    ? &hsa->format->u.array.format->u.tag :
-	NULL));
-
     hsa->i = 0;
-    if (tag != NULL && tag->tag == -2)
+    if (hsa->iterate)
 	hsa->hi = headerInitIterator(hsa->h);
     /* Normally with bells and whistles enabled, but raw dump on iteration. */
     hsa->hgflags = (hsa->hi == NULL) ? HEADERGET_EXT : HEADERGET_RAW;
+    /* Tag data is only needed while the header is being formatted */
+    hsa->hgflags |= HEADERGET_MINMEM;
 }
 
 /**
@@ -920,36 +928,76 @@ static unsigned int tagId(rpmTagVal tag)
     return tag;
 }
 
-char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+headerQueryFormat headerFormatCompile(const char * fmt, errmsg_t * errmsg)
 {
     struct headerSprintfArgs_s hsa;
-    sprintfToken nextfmt;
+    headerQueryFormat qfmt = NULL;
     sprintfTag tag;
- 
+
     memset(&hsa, 0, sizeof(hsa));
-    hsa.h = headerLink(h);
     hsa.fmt = xstrdup(fmt);
     hsa.errmsg = NULL;
 
-    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN))
+    if (parseFormat(&hsa, hsa.fmt, &hsa.format, &hsa.numTokens, NULL, PARSER_BEGIN)) {
+	free(hsa.fmt);
 	goto exit;
+    }
 
-    hsa.cache = tagCacheCreate(128, tagId, tagCmp, NULL, rpmtdFree);
-    hsa.val = xstrdup("");
+    qfmt = (headerQueryFormat)xcalloc(1, sizeof(*qfmt));
+    qfmt->fmt = hsa.fmt;
+    qfmt->format = hsa.format;
+    qfmt->numTokens = hsa.numTokens;
+    qfmt->cache = tagCacheCreate(128, tagId, tagCmp, NULL, rpmtdFree);
 
     tag =
-	(hsa.format->type == PTOK_TAG
-	    ? &hsa.format->u.tag :
-	(hsa.format->type == PTOK_ARRAY
-	    ? &hsa.format->u.array.format->u.tag :
+	(qfmt->format->type == PTOK_TAG
+	    ? &qfmt->format->u.tag :
+	(qfmt->format->type == PTOK_ARRAY
+	    ? &qfmt->format->u.array.format->u.tag :
 	NULL));
-    if (tag != NULL && tag->tag == -2 && tag->type != NULL) {
-	if (rstreq(tag->type, "xml"))
-	    hsa.xfmt = xformat_xml; /* struct assignment */
-	else if (rstreq(tag->type, "json"))
-	    hsa.xfmt = xformat_json; /* struct assignment */
+    if (tag != NULL && tag->tag == -2) {
+	qfmt->iterate = 1;
+	if (tag->type != NULL) {
+	    if (rstreq(tag->type, "xml"))
+		qfmt->xfmt = xformat_xml; /* struct assignment */
+	    else if (rstreq(tag->type, "json"))
+		qfmt->xfmt = xformat_json; /* struct assignment */
+	}
     }
 
+exit:
+    if (errmsg)
+	*errmsg = hsa.errmsg;
+    return qfmt;
+}
+
+headerQueryFormat headerFormatFree(headerQueryFormat qfmt)
+{
+    if (qfmt) {
+	freeFormat(qfmt->format, qfmt->numTokens);
+	tagCacheFree(qfmt->cache);
+	free(qfmt->fmt);
+	free(qfmt);
+    }
+    return NULL;
+}
+
+char * headerFormatExec(headerQueryFormat qfmt, Header h, errmsg_t * errmsg)
+{
+    struct headerSprintfArgs_s hsa;
+    sprintfToken nextfmt;
+
+    memset(&hsa, 0, sizeof(hsa));
+    hsa.h = headerLink(h);
+    hsa.fmt = qfmt->fmt;
+    hsa.errmsg = NULL;
+    hsa.format = qfmt->format;
+    hsa.numTokens = qfmt->numTokens;
+    hsa.iterate = qfmt->iterate;
+    hsa.xfmt = qfmt->xfmt; /* struct assignment */
+    hsa.cache = qfmt->cache;
+    hsa.val = xstrdup("");
+
     if (hsa.xfmt.xHeader)
 	hsa.xfmt.xHeader(&hsa);
 
@@ -968,14 +1016,29 @@ char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg)
     if (hsa.val != NULL && hsa.vallen < hsa.alloced)
 	hsa.val = xrealloc(hsa.val, hsa.vallen+1);	
 
-    hsa.cache = tagCacheFree(hsa.cache);
-    hsa.format = freeFormat(hsa.format, hsa.numTokens);
+    /* The data belongs to this header only */
+    tagCacheEmpty(qfmt->cache);
 
-exit:
     if (errmsg)
 	*errmsg = hsa.errmsg;
     hsa.h = headerFree(hsa.h);
-    hsa.fmt = _free(hsa.fmt);
     return hsa.val;
 }
 
+/* Callers tend to use the same format for one header after another */
+static __thread headerQueryFormat lastfmt = NULL;
+
+void headerFormatCacheFree(void)
+{
+    lastfmt = headerFormatFree(lastfmt);
+}
+
+char * headerFormat(Header h, const char * fmt, errmsg_t * errmsg) 
+{
+    if (lastfmt == NULL || !rstreq(lastfmt->fmt, fmt)) {
+	lastfmt = headerFormatFree(lastfmt);
+	if ((lastfmt = headerFormatCompile(fmt, errmsg)) == NULL)
+	    return NULL;
+    }
+    return headerFormatExec(lastfmt, h, errmsg);
+}
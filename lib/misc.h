@@ -40,6 +40,17 @@ char * rpmHeaderFormatCall(headerFmt fmt, rpmtd td);
 RPM_GNUC_INTERNAL
 int headerFindSpec(Header h);
 
+/* Free the format cached by headerFormat() in the calling thread */
+RPM_GNUC_INTERNAL
+void headerFormatCacheFree(void);
+
+/* Tags selected with rpm -q --ndjson=TAG,... (NULL for all) */
+RPM_GNUC_INTERNAL
+const rpmTagVal * rpmcliQueryTags(void);
+
+RPM_GNUC_INTERNAL
+void rpmcliQueryTagsFree(void);
+
 /**
  * Relocate files in header.
  * @todo multilib file dispositions need to be checked.
@@ -30,7 +30,6 @@ typedef struct scc_s * scc;
 struct relation_s {
     tsortInfo   rel_suc;  // pkg requiring this package
     rpmsenseFlags rel_flags; // accumulated flags of the requirements
-    struct relation_s * rel_next;
 };
 
 typedef struct relation_s * relation;
@@ -40,41 +39,136 @@ struct tsortInfo_s {
     int	     tsi_count;     // #pkgs this pkg requires
     int	     tsi_qcnt;      // #pkgs requiring this package
     int	     tsi_reqx;       // requires Idx/mark as (queued/loop)
-    struct relation_s * tsi_relations;
-    struct relation_s * tsi_forward_relations;
+    struct relation_s * tsi_relations;		// tsi_qcnt entries
+    struct relation_s * tsi_forward_relations;	// tsi_count entries
+    int      tsi_nrelations;
+    int      tsi_nforward_relations;
     tsortInfo tsi_suc;        // used for queuing (addQ)
     int      tsi_SccIdx;     // # of the SCC the node belongs to
                              // (1 for trivial SCCs)
     int      tsi_SccLowlink; // used for SCC detection
 };
 
-static void rpmTSIFree(tsortInfo tsi)
+/*
+ * A relation "q <- p" (i.e. "p" requires "q") as recorded while walking
+ * the dependencies. Both directions of the relation share this entry,
+ * the per-package adjacency rows are laid out from it once all relations
+ * are known.
+ */
+struct edge_s {
+    int pred;		/* index of the requiring package (p) */
+    int succ;		/* index of the required package (q) */
+    rpmsenseFlags flags;
+};
+
+/* Historical linked relation lists, only kept for %_tsort_verify */
+struct vrel_s {
+    int suc;
+    rpmsenseFlags flags;
+    struct vrel_s * next;
+};
+
+typedef struct tsortGraph_s {
+    tsortInfo tsi;		/* sort info array, indexed like the edges */
+    int nelem;
+    struct edge_s * edges;
+    int nedges;
+    int edgesAlloced;
+    int * lastIn;		/* most recent edge into each package */
+    int * lastOut;		/* most recent edge out of each package */
+    struct relation_s * rels;	/* adjacency rows of all packages */
+    int verify;
+    struct vrel_s ** vrels;	/* reference lists, 2 per package */
+} * tsortGraph;
+
+static void graphInit(tsortGraph g, tsortInfo tsi, int nelem, int verify)
 {
-    relation rel;
+    memset(g, 0, sizeof(*g));
+    g->tsi = tsi;
+    g->nelem = nelem;
+    g->lastIn = (int *)xmalloc(nelem * sizeof(*g->lastIn));
+    g->lastOut = (int *)xmalloc(nelem * sizeof(*g->lastOut));
+    for (int i = 0; i < nelem; i++)
+	g->lastIn[i] = g->lastOut[i] = -1;
+    g->verify = verify;
+    if (verify)
+	g->vrels = (struct vrel_s **)xcalloc(2 * nelem, sizeof(*g->vrels));
+}
 
-    while (tsi->tsi_relations != NULL) {
-	rel = tsi->tsi_relations;
-	tsi->tsi_relations = tsi->tsi_relations->rel_next;
-	free(rel);
+static void graphFree(tsortGraph g)
+{
+    if (g->vrels) {
+	for (int i = 0; i < 2 * g->nelem; i++) {
+	    while (g->vrels[i] != NULL) {
+		struct vrel_s * vrel = g->vrels[i];
+		g->vrels[i] = vrel->next;
+		free(vrel);
+	    }
+	}
+	free(g->vrels);
     }
-    while (tsi->tsi_forward_relations != NULL) {
-	rel = tsi->tsi_forward_relations;
-	tsi->tsi_forward_relations = \
-	    tsi->tsi_forward_relations->rel_next;
-	free(rel);
+    free(g->edges);
+    free(g->lastIn);
+    free(g->lastOut);
+    free(g->rels);
+}
+
+/*
+ * Record a relation into the reference lists exactly the way the linked
+ * list implementation always did, for cross checking the adjacency rows.
+ */
+static void verifyAddRelation(tsortGraph g, int pi, int qi,
+			      rpmsenseFlags flags, int reversed)
+{
+    struct vrel_s ** in = g->vrels;		/* tsi_relations */
+    struct vrel_s ** out = g->vrels + g->nelem;	/* tsi_forward_relations */
+    struct vrel_s * vrel;
+
+    if (!reversed && in[qi] && in[qi]->suc == pi) {
+	in[qi]->flags |= flags;
+	for (vrel = out[pi]; vrel; vrel = vrel->next) {
+	    if (vrel->suc == qi) {
+		vrel->flags |= flags;
+		return;
+	    }
+	}
+    }
+
+    if (reversed && out[qi] && out[qi]->suc == pi) {
+	out[qi]->flags |= flags;
+	for (vrel = in[pi]; vrel; vrel = vrel->next) {
+	    if (vrel->suc == qi) {
+		vrel->flags |= flags;
+		return;
+	    }
+	}
     }
+
+    vrel = (struct vrel_s *)xmalloc(sizeof(*vrel));
+    vrel->suc = pi;
+    vrel->flags = flags;
+    vrel->next = in[qi];
+    in[qi] = vrel;
+
+    vrel = (struct vrel_s *)xmalloc(sizeof(*vrel));
+    vrel->suc = qi;
+    vrel->flags = flags;
+    vrel->next = out[pi];
+    out[pi] = vrel;
 }
 
-static inline int addSingleRelation(rpmte p,
+static inline int addSingleRelation(tsortGraph g,
+				    rpmte p,
 				    rpmte q,
 				    rpmds dep)
 {
     struct tsortInfo_s *tsi_p, *tsi_q;
-    relation rel;
+    struct edge_s *edge;
     rpmElementType teType = rpmteType(p);
     rpmsenseFlags dsflags = rpmdsFlags(dep);
     int reversed = rpmdsIsReverse(dep);
     rpmsenseFlags flags;
+    int pi, qi, e;
 
     /* Avoid deps outside this transaction and self dependencies */
     if (q == NULL || q == p)
@@ -118,74 +212,125 @@ static inline int addSingleRelation(rpmte p,
 
     tsi_p = rpmteTSI(p);
     tsi_q = rpmteTSI(q);
+    pi = tsi_p - g->tsi;
+    qi = tsi_q - g->tsi;
 
-    /* if relation got already added just update the flags */
-    if (!reversed &&
-	tsi_q->tsi_relations && tsi_q->tsi_relations->rel_suc == tsi_p) {
-	/* must be latest one added to q as we add all rels to p at once */
-	tsi_q->tsi_relations->rel_flags |= flags;
-	/* search entry in p */
-	for (struct relation_s * tsi = tsi_p->tsi_forward_relations;
-	     tsi; tsi = tsi->rel_next) {
-	    if (tsi->rel_suc == tsi_q) {
-		tsi->rel_flags |= flags;
-		return 0;
-	    }
-	}
-	assert(0);
-    }
-
-    /* if relation got already added just update the flags */
-    if (reversed && tsi_q->tsi_forward_relations &&
-	tsi_q->tsi_forward_relations->rel_suc == tsi_p) {
-	/* must be latest one added to q as we add all rels to p at once */
-	tsi_q->tsi_forward_relations->rel_flags |= flags;
-	/* search entry in p */
-	for (struct relation_s * tsi = tsi_p->tsi_relations;
-	     tsi; tsi = tsi->rel_next) {
-	    if (tsi->rel_suc == tsi_q) {
-		tsi->rel_flags |= flags;
-		return 0;
-	    }
+    if (g->verify)
+	verifyAddRelation(g, pi, qi, flags, reversed);
+
+    /*
+     * If relation got already added just update the flags. It must be
+     * the latest one added to q as we add all rels to p at once.
+     */
+    e = reversed ? g->lastOut[qi] : g->lastIn[qi];
+    if (e >= 0) {
+	edge = g->edges + e;
+	if ((reversed ? edge->succ : edge->pred) == pi) {
+	    edge->flags |= flags;
+	    return 0;
 	}
-	assert(0);
     }
 
     /* Record next "q <- p" relation (i.e. "p" requires "q"). */
+    if (g->nedges == g->edgesAlloced) {
+	g->edgesAlloced = g->edgesAlloced ? 2 * g->edgesAlloced : 256;
+	g->edges = xrealloc(g->edges, g->edgesAlloced * sizeof(*g->edges));
+    }
+    e = g->nedges++;
+    edge = g->edges + e;
+    edge->pred = pi;
+    edge->succ = qi;
+    edge->flags = flags;
+    g->lastIn[qi] = e;
+    g->lastOut[pi] = e;
 
     /* bump p predecessor count */
     tsi_p->tsi_count++;
+    /* bump q successor count */
+    tsi_q->tsi_qcnt++;
+
+    return 0;
+}
 
-    rel = (relation)xcalloc(1, sizeof(*rel));
-    rel->rel_suc = tsi_p;
-    rel->rel_flags = flags;
+/*
+ * Lay out the recorded relations as one adjacency row per direction and
+ * package. Rows list the latest relation first, the order the sorting
+ * has always walked them in.
+ */
+static void graphBuild(tsortGraph g)
+{
+    struct relation_s * rel;
+
+    g->rels = (struct relation_s *)xmalloc(2 * g->nedges * sizeof(*g->rels));
+    rel = g->rels;
+    for (int i = 0; i < g->nelem; i++) {
+	tsortInfo tsi = g->tsi + i;
+	tsi->tsi_relations = rel;
+	tsi->tsi_nrelations = 0;
+	rel += tsi->tsi_qcnt;
+	tsi->tsi_forward_relations = rel;
+	tsi->tsi_nforward_relations = 0;
+	rel += tsi->tsi_count;
+    }
 
-    rel->rel_next = tsi_q->tsi_relations;
-    tsi_q->tsi_relations = rel;
+    for (int e = g->nedges - 1; e >= 0; e--) {
+	const struct edge_s * edge = g->edges + e;
+	tsortInfo tsi_p = g->tsi + edge->pred;
+	tsortInfo tsi_q = g->tsi + edge->succ;
 
-    
-    /* bump q successor count */
-    tsi_q->tsi_qcnt++;
+	rel = &tsi_q->tsi_relations[tsi_q->tsi_nrelations++];
+	rel->rel_suc = tsi_p;
+	rel->rel_flags = edge->flags;
 
-    rel = (relation)xcalloc(1, sizeof(*rel));
-    rel->rel_suc = tsi_q;
-    rel->rel_flags = flags;
+	rel = &tsi_p->tsi_forward_relations[tsi_p->tsi_nforward_relations++];
+	rel->rel_suc = tsi_q;
+	rel->rel_flags = edge->flags;
+    }
+}
 
-    rel->rel_next = tsi_p->tsi_forward_relations;
-    tsi_p->tsi_forward_relations = rel;
+static int verifyRelations(const struct relation_s * rels, int nrels,
+			   const struct vrel_s * vrel, tsortInfo base)
+{
+    for (int i = 0; i < nrels; i++, vrel = vrel->next) {
+	if (vrel == NULL || rels[i].rel_suc != base + vrel->suc ||
+			    rels[i].rel_flags != vrel->flags)
+	    return 1;
+    }
+    return (vrel != NULL);
+}
 
-    return 0;
+/* Compare the adjacency rows against the reference lists */
+static int graphVerify(tsortGraph g)
+{
+    int nerrs = 0;
+
+    for (int i = 0; i < g->nelem; i++) {
+	tsortInfo tsi = g->tsi + i;
+	if (verifyRelations(tsi->tsi_relations, tsi->tsi_nrelations,
+			    g->vrels[i], g->tsi) ||
+	    verifyRelations(tsi->tsi_forward_relations,
+			    tsi->tsi_nforward_relations,
+			    g->vrels[g->nelem + i], g->tsi))
+	{
+	    rpmlog(RPMLOG_ERR, _("tsort relations differ for %s\n"),
+		   rpmteNEVRA(tsi->te));
+	    nerrs++;
+	}
+    }
+    rpmlog(RPMLOG_DEBUG, "tsort verify: %d relations, %d mismatches\n",
+	   g->nedges, nerrs);
+    return nerrs;
 }
 
 /**
  * Record next "q <- p" relation (i.e. "p" requires "q").
- * @param ts		transaction set
+ * @param g		relation graph
  * @param al		packages list
  * @param p		predecessor (i.e. package that "Requires: q")
  * @param dep		dependency relation
  * @return		0 always
  */
-static inline int addRelation(rpmts ts,
+static inline int addRelation(tsortGraph g,
 			      rpmal al,
 			      rpmte p,
 			      rpmds dep)
@@ -201,18 +346,18 @@ static inline int addRelation(rpmts ts,
 	rpmrichOp op;
 	if (rpmdsParseRichDep(dep, &ds1, &ds2, &op, NULL) == RPMRC_OK) {
 	    if (op != RPMRICHOP_ELSE)
-		addRelation(ts, al, p, ds1);
+		addRelation(g, al, p, ds1);
 	    if (op == RPMRICHOP_IF || op == RPMRICHOP_UNLESS) {
 	      rpmds ds21, ds22;
 	      rpmrichOp op2;
 	      if (rpmdsParseRichDep(dep, &ds21, &ds22, &op2, NULL) == RPMRC_OK && op2 == RPMRICHOP_ELSE) {
-		  addRelation(ts, al, p, ds22);
+		  addRelation(g, al, p, ds22);
 	      }
 	      ds21 = rpmdsFree(ds21);
 	      ds22 = rpmdsFree(ds22);
 	    }
 	    if (op == RPMRICHOP_AND || op == RPMRICHOP_OR)
-		addRelation(ts, al, p, ds2);
+		addRelation(g, al, p, ds2);
 	    ds1 = rpmdsFree(ds1);
 	    ds2 = rpmdsFree(ds2);
 	}
@@ -224,7 +369,7 @@ static inline int addRelation(rpmts ts,
     if (q == NULL || q == p)
 	return 0;
 
-    addSingleRelation(p, q, dep);
+    addSingleRelation(g, p, q, dep);
 
     return 0;
 }
@@ -293,7 +438,6 @@ typedef struct sccData_s {
 static void tarjan(sccData sd, tsortInfo tsi)
 {
     tsortInfo tsi_q;
-    relation rel;
 
     /* use negative index numbers */
     sd->index--;
@@ -302,9 +446,9 @@ static void tarjan(sccData sd, tsortInfo tsi)
     tsi->tsi_SccLowlink = sd->index;
 
     sd->stack[sd->stackcnt++] = tsi;                   /* Push p on the stack */
-    for (rel=tsi->tsi_relations; rel != NULL; rel=rel->rel_next) {
+    for (int i = 0; i < tsi->tsi_nrelations; i++) {
 	/* Consider successors of p */
-	tsi_q = rel->rel_suc;
+	tsi_q = tsi->tsi_relations[i].rel_suc;
 	if (tsi_q->tsi_SccIdx > 0)
 	    /* Ignore already found SCCs */
 	    continue;
@@ -341,8 +485,8 @@ static void tarjan(sccData sd, tsortInfo tsi)
 		/* Calculate count for the SCC */
 		sd->SCCs[sd->sccCnt].count += tsi_q->tsi_count;
 		/* Subtract internal relations */
-		for (rel=tsi_q->tsi_relations; rel != NULL;
-						    rel=rel->rel_next) {
+		for (int i = 0; i < tsi_q->tsi_nrelations; i++) {
+		    relation rel = &tsi_q->tsi_relations[i];
 		    if (rel->rel_suc != tsi_q &&
 			    rel->rel_suc->tsi_SccIdx == sd->sccCnt)
 			sd->SCCs[sd->sccCnt].count--;
@@ -393,8 +537,8 @@ static scc detectSCCs(tsortInfo orderInfo, int nelem, int debugloops)
 		tsortInfo member = SCCs[i].members[j];
 		rpmlog(msglvl, "\t%s\n", rpmteNEVRA(member->te));
 		/* show relations between members */
-		relation rel = member->tsi_forward_relations;
-		for (; rel != NULL; rel=rel->rel_next) {
+		for (int k = 0; k < member->tsi_nforward_relations; k++) {
+		    relation rel = &member->tsi_forward_relations[k];
 		    if (rel->rel_suc->tsi_SccIdx!=i) continue;
 		    rpmlog(msglvl, "\t\t%s %s\n",
 			   rel->rel_flags ? "=>" : "->",
@@ -429,8 +573,8 @@ static void collectTE(rpm_color_t prefcolor, tsortInfo q,
     (*newOrderCount)++;
 
     /* T6. Erase relations. */
-    for (relation rel = q->tsi_relations; rel != NULL; rel = rel->rel_next) {
-	tsortInfo p = rel->rel_suc;
+    for (int i = 0; i < q->tsi_nrelations; i++) {
+	tsortInfo p = q->tsi_relations[i].rel_suc;
 	/* ignore already collected packages */
 	if (p->tsi_SccIdx == 0) continue;
 	if (p == q) continue;
@@ -479,7 +623,8 @@ static void dijkstra(const struct scc_s *SCC, int sccNr)
     for (int i = 0; i < SCC->size; i++) {
 	tsortInfo tsi = SCC->members[i];
 	tsi->tsi_SccLowlink = INT_MAX;
-	for (rel=tsi->tsi_forward_relations; rel != NULL; rel=rel->rel_next) {
+	for (int j = 0; j < tsi->tsi_nforward_relations; j++) {
+	    rel = &tsi->tsi_forward_relations[j];
 	    if (rel->rel_flags && rel->rel_suc->tsi_SccIdx == sccNr) {
 		if (rel->rel_suc != tsi) {
 		    tsi->tsi_SccLowlink =  0;
@@ -504,7 +649,8 @@ static void dijkstra(const struct scc_s *SCC, int sccNr)
     /* Do Dijkstra */
     while (start != end) {
 	tsortInfo tsi = queue[start++];
-	for (rel=tsi->tsi_forward_relations; rel != NULL; rel=rel->rel_next) {
+	for (int j = 0; j < tsi->tsi_nforward_relations; j++) {
+	    rel = &tsi->tsi_forward_relations[j];
 	    tsortInfo next_tsi = rel->rel_suc;
 	    if (next_tsi->tsi_SccIdx != sccNr) continue;
 	    if (next_tsi->tsi_SccLowlink > tsi->tsi_SccLowlink+1) {
@@ -585,6 +731,7 @@ int rpmtsOrder(rpmts ts)
     scc SCCs;
     int nelem = rpmtsNElements(ts);
     tsortInfo sortInfo = (tsortInfo)xcalloc(nelem, sizeof(struct tsortInfo_s));
+    struct tsortGraph_s graph;
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_ORDER), 0);
 
@@ -595,6 +742,7 @@ int rpmtsOrder(rpmts ts)
 	sortInfo[i].te = tsmem->order[i];
 	rpmteSetTSI(tsmem->order[i], &sortInfo[i]);
     }
+    graphInit(&graph, sortInfo, nelem, rpmExpandNumeric("%{?_tsort_verify}"));
 
     /* Record relations. */
     rpmlog(RPMLOG_DEBUG, "========== recording tsort relations\n");
@@ -615,12 +763,15 @@ int rpmtsOrder(rpmts ts)
 	for (int i = 0; ordertags[i]; i++) {
 	    rpmds dep = rpmdsInit(rpmteDS(p, ordertags[i]));
 	    while (rpmdsNext(dep) >= 0)
-		addRelation(ts, al, p, dep);
+		addRelation(&graph, al, p, dep);
 	}
     }
 
     rpmtsiFree(pi);
 
+    graphBuild(&graph);
+    rc = (graph.verify && graphVerify(&graph)) ? 1 : 0;
+
     newOrder = (rpmte*)xcalloc(tsmem->orderCount, sizeof(*newOrder));
     SCCs = detectSCCs(sortInfo, nelem, (rpmtsFlags(ts) & RPMTRANS_FLAG_DEPLOOPS));
 
@@ -672,8 +823,8 @@ int rpmtsOrder(rpmts ts)
     /* Clean up tsort data */
     for (int i = 0; i < nelem; i++) {
 	rpmteSetTSI(tsmem->order[i], NULL);
-	rpmTSIFree(&sortInfo[i]);
     }
+    graphFree(&graph);
     free(sortInfo);
 
     assert(newOrderCount == tsmem->orderCount);
@@ -681,7 +832,6 @@ int rpmtsOrder(rpmts ts)
     tsmem->order = _free(tsmem->order);
     tsmem->order = newOrder;
     tsmem->orderAlloced = tsmem->orderCount;
-    rc = 0;
 
     for (int i = 2; SCCs[i].members != NULL; i++) {
 	free(SCCs[i].members);
@@ -11,6 +11,8 @@
 #include <rpm/rpmstring.h>
 #include <rpm/rpmfileutil.h>
 
+#include "misc.h"
+
 #include "debug.h"
 
 #define POPT_SHOWVERSION	-999
@@ -78,6 +80,12 @@ static int cliDefine(const char *arg, int predefine)
     char *s, *t;
     /* XXX Convert '-' in macro name to underscore, skip leading %. */
     s = t = xstrdup(arg);
+    /* ...but leave the option of pure macros alone */
+    if (t[0] == '-' && t[1] == 'p' && risspace(t[2])) {
+	t += 2;
+	while (risspace(*t))
+	    t++;
+    }
     while (*t && !risspace(*t) && (*t != '(')) {
 	if (*t == '-') *t = '_';
 	t++;
@@ -283,6 +291,7 @@ rpmcliFini(poptContext optCon)
     rpmFreeMacros(NULL);
     rpmFreeMacros(rpmCLIMacroContext);
     rpmFreeRpmrc();
+    rpmcliQueryTagsFree();
     rpmlogClose();
     rpmcliInitialized = -1;
 
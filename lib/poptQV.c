@@ -7,13 +7,28 @@
 #include <string.h>
 
 #include <rpm/rpmcli.h>
+#include <rpm/argv.h>
 #include <rpm/rpmstring.h>
 #include "rpmgi.h"	/* XXX for giFlags */
+#include "misc.h"
 
 #include "debug.h"
 
 struct rpmQVKArguments_s rpmQVKArgs;
 
+/* Tags for --ndjson (NULL for all), kept out of the public struct */
+static rpmTagVal * queryTags = NULL;
+
+const rpmTagVal * rpmcliQueryTags(void)
+{
+    return queryTags;
+}
+
+void rpmcliQueryTagsFree(void)
+{
+    queryTags = _free(queryTags);
+}
+
 #define POPT_QUERYFORMAT	-1000
 #define POPT_WHATREQUIRES	-1001
 #define POPT_WHATPROVIDES	-1002
@@ -30,6 +45,7 @@ struct rpmQVKArguments_s rpmQVKArgs;
 #define POPT_WHATOBSOLETES	-1015
 #define POPT_WHATCONFLICTS	-1016
 #define POPT_QUERYBYPATH	-1017
+#define POPT_NDJSON		-1018
 
 /* ========== Query/Verify/Signature source args */
 static void rpmQVSourceArgCallback( poptContext con,
@@ -149,9 +165,38 @@ static void queryArgCallback(poptContext con,
 	break;
 
     case POPT_QUERYFORMAT:
+	if (qva->qva_flags & QUERY_FOR_JSON) {
+	    fprintf(stderr, _("--ndjson and --queryformat are mutually exclusive\n"));
+	    exit(EXIT_FAILURE);
+	}
 	rstrcat(&qva->qva_queryFormat, arg);
 	break;
 
+    case POPT_NDJSON:
+	if (qva->qva_queryFormat) {
+	    fprintf(stderr, _("--ndjson and --queryformat are mutually exclusive\n"));
+	    exit(EXIT_FAILURE);
+	}
+	qva->qva_flags |= QUERY_FOR_JSON;
+	rpmcliQueryTagsFree();
+	if (arg) {
+	    ARGV_t names = NULL;
+	    int ntags = 0;
+
+	    argvSplit(&names, arg, ", ");
+	    queryTags = xcalloc(argvCount(names) + 1, sizeof(*queryTags));
+	    for (ARGV_const_t n = names; n && *n; n++) {
+		rpmTagVal tag = rpmTagGetValue(*n);
+		if (tag == RPMTAG_NOT_FOUND) {
+		    fprintf(stderr, _("unknown tag: \"%s\"\n"), *n);
+		    exit(EXIT_FAILURE);
+		}
+		queryTags[ntags++] = tag;
+	    }
+	    argvFree(names);
+	}
+	break;
+
     case 'i':
 	if (qva->qva_mode == 'q') {
 	    const char * infoCommand[] = { "--info", NULL };
@@ -231,6 +276,8 @@ struct poptOption rpmQueryPoptTable[] = {
 	NULL, NULL },
  { "list", 'l', 0, 0, 'l',
 	N_("list files in package"), NULL },
+ { "ndjson", '\0', POPT_ARG_STRING | POPT_ARGFLAG_OPTIONAL, 0, POPT_NDJSON,
+	N_("list metadata as one JSON object per line"), "TAG,..." },
  { "qf", '\0', POPT_ARG_STRING | POPT_ARGFLAG_DOC_HIDDEN, 0, 
 	POPT_QUERYFORMAT, NULL, NULL },
  { "queryformat", '\0', POPT_ARG_STRING, 0, POPT_QUERYFORMAT,
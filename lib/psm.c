@@ -742,8 +742,10 @@ static rpmRC dbAdd(rpmts ts, rpmte te)
     headerPutUint32(h, RPMTAG_INSTALLCOLOR, &tscolor, 1);
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTE_OP_DB), 0);
     rc = (rpmdbAdd(rpmtsGetRdb(ts), h) == 0) ? RPMRC_OK : RPMRC_FAIL;
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBADD), 0);
+    (void) rpmswExit(rpmteOp(te, RPMTE_OP_DB), 0);
 
     if (rc == RPMRC_OK) {
 	rpmteSetDBInstance(te, headerGetInstance(h));
@@ -759,9 +761,11 @@ static rpmRC dbRemove(rpmts ts, rpmte te)
     rpmRC rc;
 
     (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
+    (void) rpmswEnter(rpmteOp(te, RPMTE_OP_DB), 0);
     rc = (rpmdbRemove(rpmtsGetRdb(ts), rpmteDBInstance(te)) == 0) ?
 						RPMRC_OK : RPMRC_FAIL;
     (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_DBREMOVE), 0);
+    (void) rpmswExit(rpmteOp(te, RPMTE_OP_DB), 0);
 
     if (rc == RPMRC_OK)
 	rpmteSetDBInstance(te, 0);
@@ -840,6 +844,7 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
     int once = 1;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTE_OP_INSTALL), 0);
     while (once--) {
 	/* HACK: replacepkgs abuses te instance to remove old header */
 	if (rpmtsFilterFlags(psm->ts) & RPMPROB_FILTER_REPLACEPKG)
@@ -930,6 +935,7 @@ static rpmRC rpmPackageInstall(rpmts ts, rpmpsm psm)
     }
 
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTE_OP_INSTALL), 0);
 
     return rc;
 }
@@ -940,6 +946,7 @@ static rpmRC rpmPackageErase(rpmts ts, rpmpsm psm)
     int once = 1;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_ERASE), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTE_OP_ERASE), 0);
     while (once--) {
 
 	if (!(rpmtsFlags(ts) & RPMTRANS_FLAG_NOTRIGGERUN)) {
@@ -1018,6 +1025,7 @@ static rpmRC rpmPackageErase(rpmts ts, rpmpsm psm)
     }
 
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_ERASE), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTE_OP_ERASE), 0);
 
     return rc;
 }
@@ -1027,6 +1035,7 @@ static rpmRC rpmPackageRestore(rpmts ts, rpmpsm psm)
     rpmRC rc = RPMRC_OK;
 
     rpmswEnter(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswEnter(rpmteOp(psm->te, RPMTE_OP_INSTALL), 0);
     rc = rpmChrootIn() ? RPMRC_FAIL : RPMRC_OK;
     if (rc == RPMRC_OK) {
 	char *failedFile = NULL;
@@ -1050,6 +1059,7 @@ static rpmRC rpmPackageRestore(rpmts ts, rpmpsm psm)
 	rpmChrootOut();
     }
     rpmswExit(rpmtsOp(psm->ts, RPMTS_OP_INSTALL), 0);
+    rpmswExit(rpmteOp(psm->te, RPMTE_OP_INSTALL), 0);
 
     return rc;
 }
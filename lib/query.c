@@ -21,6 +21,7 @@
 
 #include "rpmgi.h"
 #include "manifest.h"
+#include "misc.h"
 
 #include "debug.h"
 
@@ -98,6 +99,12 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
     int rc = 0;		/* XXX FIXME: need real return code */
     time_t now = 0;
 
+    if (qva->qva_flags & QUERY_FOR_JSON) {
+	char *str = headerJSON(h, rpmcliQueryTags());
+	rpmlog(RPMLOG_NOTICE, "%s", str);
+	free(str);
+    }
+
     if (qva->qva_queryFormat != NULL) {
 	const char *errstr;
 	char *str = headerFormat(h, qva->qva_queryFormat, &errstr);
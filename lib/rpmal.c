@@ -9,6 +9,7 @@
 #include <rpm/rpmfi.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmstrpool.h>
+#include <rpm/rpmver.h>
 
 #include "rpmal.h"
 #include "misc.h"
@@ -49,6 +50,29 @@ typedef struct availableIndexEntry_s {
 #undef HTKEYTYPE
 #undef HTDATATYPE
 
+/** \ingroup rpmdep
+ * Providers of a single name, with the versioned ones sorted by EVR.
+ */
+typedef struct availableRange_s {
+    int nsorted;		/*!< No. of "= EVR" provides */
+    int nother;			/*!< No. of other provides */
+    const char ** keys;		/*!< EVR sort keys of sorted entries */
+    struct availableIndexEntry_s * sorted; /*!< Entries in EVR order */
+    struct availableIndexEntry_s * other; /*!< Entries always checked */
+} * availableRange;
+
+/* Minimum number of providers of a name to use EVR range lookups */
+#define RANGE_MIN_PROVIDERS	16
+
+#define HASHTYPE rpmalRangeHash
+#define HTKEYTYPE rpmsid
+#define HTDATATYPE availableRange
+#include "rpmhash.H"
+#include "rpmhash.C"
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+
 typedef struct availableIndexFileEntry_s {
     rpmsid dirName;
     rpmalNum pkgNum;	        /*!< Containing package index. */
@@ -71,6 +95,7 @@ struct rpmal_s {
     rpmstrPool pool;		/*!< String pool */
     availablePackage list;	/*!< Set of packages. */
     rpmalDepHash providesHash;
+    rpmalRangeHash rangeHash;	/*!< EVR sorted providers, built on demand */
     rpmalDepHash obsoletesHash;
     rpmalFileHash fileHash;
     int delta;			/*!< Delta for pkg list reallocation. */
@@ -89,6 +114,7 @@ struct rpmal_s {
 static void rpmalFreeIndex(rpmal al)
 {
     al->providesHash = rpmalDepHashFree(al->providesHash);
+    al->rangeHash = rpmalRangeHashFree(al->rangeHash);
     al->obsoletesHash = rpmalDepHashFree(al->obsoletesHash);
     al->fileHash = rpmalFileHashFree(al->fileHash);
     al->fpc = fpCacheFree(al->fpc);
@@ -105,6 +131,7 @@ rpmal rpmalCreate(rpmts ts, int delta)
     al->list = (availablePackage)xmalloc(sizeof(*al->list) * al->alloced);
 
     al->providesHash = NULL;
+    al->rangeHash = NULL;
     al->obsoletesHash = NULL;
     al->fileHash = NULL;
     al->tsflags = rpmtsFlags(ts);
@@ -269,6 +296,9 @@ void rpmalAdd(rpmal al, rpmte p)
     /* Try to be lazy as delayed hash creation is cheaper */
     if (al->providesHash != NULL)
 	rpmalAddProvides(al, pkgNum, alp->provides);
+    /* Range indexes are rebuilt on demand when provides change */
+    if (al->rangeHash != NULL)
+	rpmalRangeHashEmpty(al->rangeHash);
     if (al->obsoletesHash != NULL)
 	rpmalAddObsoletes(al, pkgNum, alp->obsoletes);
     if (al->fileHash != NULL)
@@ -431,6 +461,183 @@ static rpmte * rpmalAllFileSatisfiesDepend(const rpmal al, const char *fileName,
     return ret;
 }
 
+static availableRange availableRangeFree(availableRange r)
+{
+    if (r) {
+	free(r->keys);
+	free(r->sorted);
+	free(r->other);
+	free(r);
+    }
+    return NULL;
+}
+
+/* Is the epoch of an EVR missing or all digits? */
+static int rangeableEpoch(rpmver rv)
+{
+    const char *e = rpmverE(rv);
+    if (e) {
+	for (; *e; e++)
+	    if (!risdigit(*e))
+		return 0;
+    }
+    return 1;
+}
+
+struct rangeSort_s {
+    const char *key;
+    struct availableIndexEntry_s entry;
+};
+
+static int rangeSortCmp(const void *a, const void *b)
+{
+    const struct rangeSort_s *ra = (const struct rangeSort_s *)a;
+    const struct rangeSort_s *rb = (const struct rangeSort_s *)b;
+    return strcmp(ra->key, rb->key);
+}
+
+/*
+ * Build the EVR range index for providers of a name. Only plain
+ * "name = EVR" provides with a numeric (or no) epoch are sorted, all
+ * the others are always checked the slow way.
+ */
+static availableRange rpmalMakeRange(rpmal al, availableIndexEntry result,
+				     int resultCnt)
+{
+    availableRange r = (availableRange)xcalloc(1, sizeof(*r));
+    struct rangeSort_s *rs = (struct rangeSort_s *)xmalloc(resultCnt * sizeof(*rs));
+
+    r->other = (availableIndexEntry)xmalloc(resultCnt * sizeof(*r->other));
+    for (int i = 0; i < resultCnt; i++) {
+	rpmds provides = al->list[result[i].pkgNum].provides;
+	int ix = result[i].entryIx;
+	rpmsenseFlags sense = rpmdsFlagsIndex(provides, ix) & RPMSENSE_SENSEMASK;
+	const char *evr = rpmdsEVRIndex(provides, ix);
+	const char *key = NULL;
+
+	if (sense == RPMSENSE_EQUAL && evr && *evr) {
+	    rpmver rv = rpmverParse(evr);
+	    if (rangeableEpoch(rv)) {
+		key = rpmstrPoolEVRKey(rpmdsPool(provides),
+				       rpmdsEVRIdIndex(provides, ix));
+	    }
+	    rpmverFree(rv);
+	}
+
+	if (key) {
+	    rs[r->nsorted].key = key;
+	    rs[r->nsorted].entry = result[i];
+	    r->nsorted++;
+	} else {
+	    r->other[r->nother++] = result[i];
+	}
+    }
+
+    qsort(rs, r->nsorted, sizeof(*rs), rangeSortCmp);
+    r->keys = (const char **)xmalloc(r->nsorted * sizeof(*r->keys));
+    r->sorted = (availableIndexEntry)xmalloc(r->nsorted * sizeof(*r->sorted));
+    for (int i = 0; i < r->nsorted; i++) {
+	r->keys[i] = rs[i].key;
+	r->sorted[i] = rs[i].entry;
+    }
+    free(rs);
+
+    return r;
+}
+
+/* Return index of first key not below (or with upper set, above) bound */
+static int rangeSearch(availableRange r, const char *bound, int upper)
+{
+    int lo = 0, hi = r->nsorted;
+    while (lo < hi) {
+	int mid = lo + (hi - lo) / 2;
+	int cmp = strcmp(r->keys[mid], bound);
+	if (cmp < 0 || (upper && cmp == 0))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static int entryCmp(const void *a, const void *b)
+{
+    const struct availableIndexEntry_s *ea = (const struct availableIndexEntry_s *)a;
+    const struct availableIndexEntry_s *eb = (const struct availableIndexEntry_s *)b;
+    if (ea->pkgNum != eb->pkgNum)
+	return (ea->pkgNum < eb->pkgNum) ? -1 : 1;
+    if (ea->entryIx != eb->entryIx)
+	return (ea->entryIx < eb->entryIx) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Narrow down the providers of a name to the ones whose epoch:version
+ * can overlap with the dependency range. This is a superset of the actual
+ * matches which still need checking with rpmdsCompareIndex(), returned in
+ * the same order as the provides hash has them. Returns NULL if the
+ * dependency range can't be used for narrowing.
+ */
+static availableIndexEntry rpmalRangeLookup(rpmal al, rpmsid nameId,
+					availableIndexEntry result,
+					int resultCnt, rpmds ds, int *candCnt)
+{
+    rpmsenseFlags sense = rpmdsFlags(ds) & RPMSENSE_SENSEMASK;
+    const char *evr = rpmdsEVR(ds);
+    availableIndexEntry cand = NULL;
+    availableRange r = NULL;
+    availableRange *rp = NULL;
+    rpmver rv, ev;
+    char *lo = NULL, *hi = NULL;
+    int first, last;
+
+    if (!sense || evr == NULL || *evr == '\0')
+	return NULL;
+
+    rv = rpmverParse(evr);
+    ev = rangeableEpoch(rv) ? rpmverNew(rpmverE(rv), rpmverV(rv), NULL) : NULL;
+    rpmverFree(rv);
+    if (ev == NULL)
+	return NULL;
+
+    if (al->rangeHash == NULL)
+	al->rangeHash = rpmalRangeHashCreate(127, sidHash, sidCmp, NULL,
+					     availableRangeFree);
+    if (rpmalRangeHashGetEntry(al->rangeHash, nameId, &rp, NULL, NULL)) {
+	r = rp[0];
+    } else {
+	r = rpmalMakeRange(al, result, resultCnt);
+	rpmalRangeHashAddEntry(al->rangeHash, nameId, r);
+    }
+
+    /*
+     * The epoch:version key ends in the lowest possible release byte,
+     * turning that into the highest one gives the upper bound.
+     */
+    if (!(sense & RPMSENSE_LESS))
+	lo = rpmverKey(ev);
+    if (!(sense & RPMSENSE_GREATER)) {
+	hi = rpmverKey(ev);
+	hi[strlen(hi) - 1] = '\xff';
+    }
+    rpmverFree(ev);
+
+    first = lo ? rangeSearch(r, lo, 0) : 0;
+    last = hi ? rangeSearch(r, hi, 1) : r->nsorted;
+    if (last < first)
+	last = first;
+
+    *candCnt = r->nother + (last - first);
+    cand = (availableIndexEntry)xmalloc((*candCnt + 1) * sizeof(*cand));
+    memcpy(cand, r->other, r->nother * sizeof(*cand));
+    memcpy(cand + r->nother, r->sorted + first, (last - first) * sizeof(*cand));
+    qsort(cand, *candCnt, sizeof(*cand), entryCmp);
+
+    free(lo);
+    free(hi);
+    return cand;
+}
+
 rpmte * rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 {
     rpmte * ret = NULL;
@@ -438,6 +645,7 @@ rpmte * rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
     rpmsid nameId;
     const char *name;
     availableIndexEntry result;
+    availableIndexEntry cand = NULL;
     int resultCnt;
     int obsolete;
     rpmTagVal dtag;
@@ -473,6 +681,20 @@ rpmte * rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 
     if (resultCnt==0) return NULL;
 
+    /* With lots of providers, only look at the ones in the EVR range */
+    if (!obsolete && resultCnt >= RANGE_MIN_PROVIDERS) {
+	int candCnt = 0;
+	cand = rpmalRangeLookup(al, nameId, result, resultCnt, ds, &candCnt);
+	if (cand) {
+	    if (candCnt == 0) {
+		free(cand);
+		return NULL;
+	    }
+	    result = cand;
+	    resultCnt = candCnt;
+	}
+    }
+
     ret = (rpmte *)xmalloc((resultCnt+1) * sizeof(*ret));
 
     for (found=i=0; i<resultCnt; i++) {
@@ -498,6 +720,7 @@ rpmte * rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds)
 	if (rc)
 	    ret[found++] = alp->p;
     }
+    free(cand);
 
     if (found) {
 	rpmdsNotify(ds, "(added provide)", 0);
@@ -36,6 +36,7 @@
 #include "backend/dbi.h"
 #include "backend/dbiset.h"
 #include "misc.h"
+#include "verifycache.h"
 #include "debug.h"
 
 #define HASHTYPE dbChk
@@ -384,6 +385,7 @@ int rpmdbClose(rpmdb db)
     db->db_home = _free(db->db_home);
     db->db_fullpath = _free(db->db_fullpath);
     db->db_checked = dbChkFree(db->db_checked);
+    db->db_verified = verifyCacheFree(db->db_verified);
     db->db_indexes = _free(db->db_indexes);
 
     db = _free(db);
@@ -438,6 +440,8 @@ static rpmdb newRpmdb(const char * root, const char * home,
     db->db_fullpath = rpmGenPath(db->db_root, db->db_home, NULL);
     db->db_tags = dbiTags;
     db->db_ndbi = sizeof(dbiTags) / sizeof(rpmDbiTag);
+    db->cfg.db_lazy_headers = rpmExpandNumeric("%{?_db_lazy_headers}");
+    db->cfg.db_verify_cache = rpmExpandNumeric("%{?_db_verify_cache}");
     db->db_indexes = (dbiIndex *)xcalloc(db->db_ndbi, sizeof(*db->db_indexes));
     db->nrefs = 0;
     return rpmdbLink(db);
@@ -1342,9 +1346,23 @@ int rpmdbSetHdrChk(rpmdbMatchIterator mi, rpmts ts,
     return rc;
 }
 
+static verifyCache miVerifyCache(rpmdbMatchIterator mi)
+{
+    rpmdb db = mi->mi_db;
+
+    /* Only try once, loading the keyring can read headers from here too */
+    if (db->db_verified == NULL && db->cfg.db_verify_cache) {
+	db->cfg.db_verify_cache = 0;
+	db->db_verified = verifyCacheNew(rpmdbHome(db), mi->mi_ts);
+    }
+    return db->db_verified;
+}
+
 static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 {
     rpmRC rpmrc = RPMRC_NOTFOUND;
+    verifyCache vc;
+    char *digest = NULL;
 
     if (!(mi->mi_hdrchk && mi->mi_ts))
 	return rpmrc;
@@ -1358,6 +1376,18 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 	}
     }
 
+    /* Nor one verified by an earlier process, if the blob is the same. */
+    if (rpmrc != RPMRC_OK && (vc = miVerifyCache(mi)) != NULL) {
+	digest = verifyCacheDigest(uh, uhlen);
+	if (verifyCacheGet(vc, mi->mi_ts, mi->mi_offset, digest)) {
+	    rpmlog(RPMLOG_DEBUG, "%s h#%8u %s\n", " read", mi->mi_offset,
+		   "Header verified earlier");
+	    rpmrc = RPMRC_OK;
+	    if (mi->mi_db->db_checked)
+		dbChkAddEntry(mi->mi_db->db_checked, mi->mi_offset, rpmrc);
+	}
+    }
+
     /* If blob is unchecked, check blob import consistency now. */
     if (rpmrc != RPMRC_OK) {
 	char * msg = NULL;
@@ -1374,7 +1404,11 @@ static rpmRC miVerifyHeader(rpmdbMatchIterator mi, const void *uh, size_t uhlen)
 	if (mi->mi_db && mi->mi_db->db_checked) {
 	    dbChkAddEntry(mi->mi_db->db_checked, mi->mi_offset, rpmrc);
 	}
+	if (rpmrc == RPMRC_OK && digest)
+	    verifyCachePut(mi->mi_db->db_verified, mi->mi_ts, mi->mi_offset,
+			   digest);
     }
+    free(digest);
     return rpmrc;
 }
 
@@ -1396,6 +1430,8 @@ Header rpmdbNextIterator(rpmdbMatchIterator mi)
 #if defined(_USE_COPY_LOAD)
     importFlags |= HEADERIMPORT_COPY;
 #endif
+    if (mi->mi_db->cfg.db_lazy_headers)
+	importFlags |= HEADERIMPORT_LAZY;
     /*
      * Cursors are per-iterator, not per-dbi, so get a cursor for the
      * iterator on 1st call. If the iteration is to rewrite headers,
@@ -1999,6 +2035,11 @@ int rpmdbRemove(rpmdb db, unsigned int hdrNum)
     dbCtrl(db, DB_CTRL_UNLOCK_RW);
     rpmsqBlock(SIG_UNBLOCK);
 
+    verifyCacheDel(db->db_verified, hdrNum);
+    /* Results verified with the removed key are stale */
+    if (headerIsEntry(h, RPMTAG_PUBKEYS))
+	db->db_verified = verifyCacheFree(db->db_verified);
+
     headerFree(h);
 
     /* XXX return ret; */
@@ -2246,9 +2287,11 @@ int rpmdbAdd(rpmdb db, Header h)
     /* If everything ok, mark header as installed now */
     if (ret == 0) {
 	headerSetInstance(h, hdrNum);
-	/* Purge our verification cache on added public keys */
-	if (db->db_checked && headerIsEntry(h, RPMTAG_PUBKEYS)) {
-	    dbChkEmpty(db->db_checked);
+	/* Purge our verification caches on added public keys */
+	if (headerIsEntry(h, RPMTAG_PUBKEYS)) {
+	    if (db->db_checked)
+		dbChkEmpty(db->db_checked);
+	    db->db_verified = verifyCacheFree(db->db_verified);
 	}
     }
 
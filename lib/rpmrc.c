@@ -34,6 +34,7 @@
 
 #include "rpmlua.h"
 #include "rpmio_internal.h"	/* XXX for rpmioSlurp */
+#include "rpmmacro_internal.h"	/* rpmInitMacrosSnapshot */
 #include "misc.h"
 #include "backend/dbi.h"
 #include "rpmug.h"
@@ -118,6 +119,7 @@ typedef struct tableType_s {
 #define RPMVAR_ARCHCOLOR                42
 #define RPMVAR_INCLUDE                  43
 #define RPMVAR_MACROFILES               49
+#define RPMVAR_MACROSNAPSHOT            50
 
 #define RPMVAR_NUM                      55      /* number of RPMVAR entries */
 
@@ -128,6 +130,7 @@ static const struct rpmOption optionTable[] = {
     { "archcolor",		RPMVAR_ARCHCOLOR,               1, 0, 0 },
     { "include",		RPMVAR_INCLUDE,			0, 0, 2 },
     { "macrofiles",		RPMVAR_MACROFILES,		0, 0, 1 },
+    { "macrosnapshot",		RPMVAR_MACROSNAPSHOT,		0, 0, 1 },
     { "optflags",		RPMVAR_OPTFLAGS,		1, 1, 0 },
 };
 
@@ -1805,8 +1808,11 @@ int rpmReadConfigFiles(const char * file, const char * target)
 	goto exit;
 
     if (macrofiles != NULL) {
+	const char *snap = rpmGetVarArch(ctx, RPMVAR_MACROSNAPSHOT, NULL);
 	char *mf = rpmGetPath(macrofiles, NULL);
-	rpmInitMacros(NULL, mf);
+	char *sf = snap ? rpmGetPath(snap, NULL) : NULL;
+	rpmInitMacrosSnapshot(NULL, mf, sf);
+	_free(sf);
 	_free(mf);
     }
 
@@ -1901,6 +1907,7 @@ void rpmFreeRpmrc(void)
     rpmlua lua = rpmluaGetGlobalState();
     rpmluaFree(lua);
     rpmugFree();
+    headerFormatCacheFree();
 
     rpmrcCtxRelease(ctx);
     return;
@@ -81,6 +81,8 @@ struct rpmte_s {
     int failed;			/*!< (parent) install/erase failed */
 
     rpmfs fs;
+
+    struct rpmop_s ops[RPMTE_OP_MAX];	/*!< Operation statistics */
 };
 
 /* forward declarations */
@@ -375,6 +377,14 @@ unsigned int rpmteHeaderSize(rpmte te)
     return (te != NULL ? te->headerSize : 0);
 }
 
+rpmop rpmteOp(rpmte te, rpmteOpX opx)
+{
+    rpmop op = NULL;
+    if (te != NULL && opx >= 0 && opx < RPMTE_OP_MAX)
+	op = te->ops + opx;
+    return op;
+}
+
 rpmte rpmteParent(rpmte te)
 {
     return (te != NULL ? te->parent : NULL);
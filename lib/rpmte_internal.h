@@ -4,6 +4,7 @@
 #include <rpm/rpmte.h>
 #include <rpm/rpmds.h>
 #include <rpm/rpmtag.h>
+#include <rpm/rpmsw.h>
 #include "rpmfs.h"
 
 typedef enum pkgGoal_e {
@@ -22,6 +23,20 @@ typedef enum pkgGoal_e {
     PKG_TRANSFILETRIGGERUN	= RPMTAG_TRANSFILETRIGGERUN,
 } pkgGoal;
 
+/** \ingroup rpmte
+ * Per transaction element operation statistics.
+ */
+typedef enum rpmteOpX_e {
+    RPMTE_OP_INSTALL	= 0,
+    RPMTE_OP_ERASE	= 1,
+    RPMTE_OP_SCRIPTLETS	= 2,
+    RPMTE_OP_UNCOMPRESS	= 3,
+    RPMTE_OP_DIGEST	= 4,
+    RPMTE_OP_FSM	= 5,	/*!< count is # of filesystem calls */
+    RPMTE_OP_DB		= 6,
+    RPMTE_OP_MAX	= 7
+} rpmteOpX;
+
 /** \ingroup rpmte
  * Transaction element ordering chain linkage.
  */
@@ -118,5 +133,14 @@ rpmRC rpmpsmRun(rpmts ts, rpmte te, pkgGoal goal);
 RPM_GNUC_INTERNAL
 int rpmteAddOp(rpmte te);
 
+/** \ingroup rpmte
+ * Retrieve operation statistics of a transaction element.
+ * @param te		transaction element
+ * @param opx		operation statistic index
+ * @return		operation statistic pointer
+ */
+RPM_GNUC_INTERNAL
+rpmop rpmteOp(rpmte te, rpmteOpX opx);
+
 #endif	/* _RPMTE_INTERNAL_H */
 
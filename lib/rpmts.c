@@ -829,6 +829,134 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("dbdel:       ", rpmtsOp(ts, RPMTS_OP_DBDEL));
 }
 
+static void jsonStat(FILE *f, const char *name, rpmop op, int comma)
+{
+    fprintf(f, "%s\"%s\":{\"count\":%d,\"bytes\":%zu,\"usecs\":%lu}",
+	    comma ? "," : "", name, op->count, op->bytes,
+	    (unsigned long)op->usecs);
+}
+
+static void jsonString(FILE *f, const char *name, const char *s)
+{
+    fprintf(f, ",\"%s\":\"", name);
+    for (; s && *s; s++) {
+	unsigned char c = *s;
+	if (c == '"' || c == '\\')
+	    fprintf(f, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf(f, "\\u%04x", c);
+	else
+	    fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/*
+ * Schema version 1, one object per line:
+ * {"version":1,"tid":..,"result":..,"ops":{<op>...},"db":{<op>...},
+ *  "elements":[{"nevra":..,"type":..,"failed":..,"ops":{<op>...}}...]}
+ * where each <op> is "name":{"count":..,"bytes":..,"usecs":..}
+ */
+void rpmtsWriteStats(rpmts ts, int rc)
+{
+    static const struct {
+	const char *name;
+	rpmtsOpX opx;
+    } tsops[] = {
+	{ "total",	RPMTS_OP_TOTAL },
+	{ "check",	RPMTS_OP_CHECK },
+	{ "order",	RPMTS_OP_ORDER },
+	{ "verify",	RPMTS_OP_VERIFY },
+	{ "fingerprint",RPMTS_OP_FINGERPRINT },
+	{ "install",	RPMTS_OP_INSTALL },
+	{ "erase",	RPMTS_OP_ERASE },
+	{ "scriptlets",	RPMTS_OP_SCRIPTLETS },
+	{ "uncompress",	RPMTS_OP_UNCOMPRESS },
+	{ "digest",	RPMTS_OP_DIGEST },
+	{ "signature",	RPMTS_OP_SIGNATURE },
+	{ "dbadd",	RPMTS_OP_DBADD },
+	{ "dbremove",	RPMTS_OP_DBREMOVE },
+    };
+    static const struct {
+	const char *name;
+	rpmtsOpX tsopx;
+	rpmdbOpX dbopx;
+    } dbops[] = {
+	{ "get",	RPMTS_OP_DBGET,	RPMDB_OP_DBGET },
+	{ "put",	RPMTS_OP_DBPUT,	RPMDB_OP_DBPUT },
+	{ "del",	RPMTS_OP_DBDEL,	RPMDB_OP_DBDEL },
+    };
+    static const char * const teops[] = {
+	[RPMTE_OP_INSTALL]	= "install",
+	[RPMTE_OP_ERASE]	= "erase",
+	[RPMTE_OP_SCRIPTLETS]	= "scriptlets",
+	[RPMTE_OP_UNCOMPRESS]	= "uncompress",
+	[RPMTE_OP_DIGEST]	= "digest",
+	[RPMTE_OP_FSM]		= "fsm",
+	[RPMTE_OP_DB]		= "db",
+    };
+    char *fn = rpmGetPath("%{?_transaction_stats}", NULL);
+    FILE *f = NULL;
+    rpmtsi pi;
+    rpmte p;
+
+    if (*fn == '\0')
+	goto exit;
+
+    f = fopen(fn, "a");
+    if (f == NULL) {
+	rpmlog(RPMLOG_WARNING, _("cannot write transaction stats to %s: %s\n"),
+	       fn, strerror(errno));
+	goto exit;
+    }
+
+    fprintf(f, "{\"version\":1,\"tid\":%u,\"result\":%d,\"ops\":{",
+	    (unsigned)rpmtsGetTid(ts), rc);
+    for (size_t i = 0; i < sizeof(tsops) / sizeof(tsops[0]); i++) {
+	struct rpmop_s op = *rpmtsOp(ts, tsops[i].opx);
+	/* the total is still running */
+	if (tsops[i].opx == RPMTS_OP_TOTAL)
+	    (void) rpmswExit(&op, 0);
+	jsonStat(f, tsops[i].name, &op, i > 0);
+    }
+
+    /* database operations not yet accounted to the ts until close */
+    fprintf(f, "},\"db\":{");
+    for (size_t i = 0; i < sizeof(dbops) / sizeof(dbops[0]); i++) {
+	struct rpmop_s op = *rpmtsOp(ts, dbops[i].tsopx);
+	if (ts->rdb)
+	    (void) rpmswAdd(&op, rpmdbOp(ts->rdb, dbops[i].dbopx));
+	jsonStat(f, dbops[i].name, &op, i > 0);
+    }
+
+    fprintf(f, "},\"elements\":[");
+    pi = rpmtsiInit(ts);
+    for (int n = 0; (p = rpmtsiNext(pi, 0)) != NULL; n++) {
+	fprintf(f, "%s{", n ? "," : "");
+	fprintf(f, "\"failed\":%d", rpmteFailed(p));
+	jsonString(f, "nevra", rpmteNEVRA(p));
+	switch (rpmteType(p)) {
+	case TR_ADDED:		jsonString(f, "type", "install");	break;
+	case TR_REMOVED:	jsonString(f, "type", "erase");		break;
+	case TR_RESTORED:	jsonString(f, "type", "restore");	break;
+	default:		jsonString(f, "type", "");		break;
+	}
+	fprintf(f, ",\"ops\":{");
+	for (int i = 0; i < RPMTE_OP_MAX; i++)
+	    jsonStat(f, teops[i], rpmteOp(p, i), i);
+	fprintf(f, "}}");
+    }
+    rpmtsiFree(pi);
+    fprintf(f, "]}\n");
+
+    if (fclose(f))
+	rpmlog(RPMLOG_WARNING, _("cannot write transaction stats to %s: %s\n"),
+	       fn, strerror(errno));
+
+exit:
+    free(fn);
+}
+
 rpmts rpmtsFree(rpmts ts)
 {
     tsMembers tsmem = rpmtsMembers(ts);
@@ -126,4 +126,13 @@ int rpmtsNotifyChange(rpmts ts, int event, rpmte te, rpmte other);
 RPM_GNUC_INTERNAL
 rpm_time_t rpmtsGetTime(rpmts ts, time_t step);
 
+/** \ingroup rpmts
+ * Append transaction and per element statistics as a JSON object
+ * to the file configured in %_transaction_stats, if any.
+ * @param ts		transaction set
+ * @param rc		transaction result
+ */
+RPM_GNUC_INTERNAL
+void rpmtsWriteStats(rpmts ts, int rc);
+
 #endif /* _RPMTS_INTERNAL_H */
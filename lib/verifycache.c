@@ -0,0 +1,288 @@
+/** \ingroup rpmdb
+ * \file lib/verifycache.c
+ *  On-disk cache of rpmdb headers verified by earlier processes
+ */
+
+#include "system.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <rpm/rpmcrypto.h>
+#include <rpm/rpmkeyring.h>
+#include <rpm/rpmlib.h>
+#include <rpm/rpmlog.h>
+#include <rpm/rpmstring.h>
+#include <rpm/rpmts.h>
+
+#include "verifycache.h"
+
+#include "debug.h"
+
+#define HASHTYPE verifiedIndex
+#define HTKEYTYPE unsigned int
+#define HTDATATYPE int
+#include "rpmhash.H"
+#include "rpmhash.C"
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+
+#define VERIFYCACHE_MAGIC "rpmdb-verified 1"
+#define VERIFYCACHE_ALGO RPM_HASH_SHA256
+
+/*
+ * Verification results depend on the verify flags and the keys
+ * available, so the file starts with a line identifying those. Only
+ * headers that passed verification are stored, one per line as the
+ * header number and the digest of the header blob. A hit requires
+ * the blob read to have the same digest, the header number only serves
+ * to find and drop entries of removed headers.
+ */
+typedef struct verifyEntry_s {
+    unsigned int hdrNum;
+    char *digest;		/* NULL if removed */
+} * verifyEntry;
+
+struct verifyCache_s {
+    char *path;			/* cache file */
+    char *context;		/* rpm version, verify flags and keyring */
+    char *keydigest;		/* digest of the keyring when loaded */
+    rpmKeyring keyring;		/* keyring the results are valid for */
+    rpmVSFlags vsflags;		/* verify flags the results are valid for */
+    struct verifyEntry_s *entries;
+    int nentries;
+    int alloced;
+    verifiedIndex index;	/* header number -> entry index */
+    int dirty;
+};
+
+static unsigned int uintId(unsigned int a)
+{
+    return a;
+}
+
+static int uintCmp(unsigned int a, unsigned int b)
+{
+    return (a != b);
+}
+
+static verifyEntry findEntry(verifyCache vc, unsigned int hdrNum)
+{
+    int *ix = NULL;
+    if (verifiedIndexGetEntry(vc->index, hdrNum, &ix, NULL, NULL))
+	return &vc->entries[ix[0]];
+    return NULL;
+}
+
+static verifyEntry addEntry(verifyCache vc, unsigned int hdrNum)
+{
+    verifyEntry e;
+
+    if (vc->nentries == vc->alloced) {
+	vc->alloced += 1024;
+	vc->entries = (verifyEntry)xrealloc(vc->entries,
+				vc->alloced * sizeof(*vc->entries));
+    }
+    e = &vc->entries[vc->nentries];
+    e->hdrNum = hdrNum;
+    e->digest = NULL;
+    verifiedIndexAddEntry(vc->index, hdrNum, vc->nentries);
+    vc->nentries++;
+    return e;
+}
+
+static int isDigest(const char *s)
+{
+    size_t len = strspn(s, "0123456789abcdef");
+    return (len == 2 * rpmDigestLength(VERIFYCACHE_ALGO) && s[len] == '\0');
+}
+
+static void cacheLoad(verifyCache vc)
+{
+    FILE *f = fopen(vc->path, "r");
+    char *line = NULL;
+    size_t linesz = 0;
+    ssize_t nb;
+    int lineno = 0;
+
+    if (f == NULL)
+	return;
+
+    while ((nb = getline(&line, &linesz, f)) > 0) {
+	unsigned int hdrNum;
+	char *s;
+
+	if (line[nb-1] == '\n')
+	    line[nb-1] = '\0';
+
+	/* Results of other rpm versions, flags and keys don't apply */
+	if (lineno++ < 2) {
+	    if (!rstreq(line, lineno == 1 ? VERIFYCACHE_MAGIC : vc->context))
+		break;
+	    continue;
+	}
+
+	hdrNum = strtoul(line, &s, 10);
+	if (s == line || *s++ != '\t' || !isDigest(s) || hdrNum == 0)
+	    continue;
+	if (findEntry(vc, hdrNum))
+	    continue;
+	addEntry(vc, hdrNum)->digest = xstrdup(s);
+    }
+    free(line);
+    fclose(f);
+
+    rpmlog(RPMLOG_DEBUG, "loaded %d verified headers from %s\n",
+	   vc->nentries, vc->path);
+}
+
+static void cacheSave(verifyCache vc)
+{
+    char *tmppath = rstrscat(NULL, vc->path, ".XXXXXX", NULL);
+    FILE *f = NULL;
+    int fd = mkstemp(tmppath);
+    int nsaved = 0;
+
+    if (fd < 0 || fchmod(fd, 0644) || (f = fdopen(fd, "w")) == NULL)
+	goto err;
+
+    fprintf(f, "%s\n%s\n", VERIFYCACHE_MAGIC, vc->context);
+    for (int i = 0; i < vc->nentries; i++) {
+	verifyEntry e = &vc->entries[i];
+	if (e->digest == NULL)
+	    continue;
+	fprintf(f, "%u\t%s\n", e->hdrNum, e->digest);
+	nsaved++;
+    }
+
+    fd = -1;
+    if (fclose(f) || rename(tmppath, vc->path))
+	goto err;
+
+    rpmlog(RPMLOG_DEBUG, "saved %d verified headers to %s\n",
+	   nsaved, vc->path);
+    free(tmppath);
+    return;
+
+err:
+    /* Not being able to write the database directory is normal for users */
+    rpmlog(RPMLOG_DEBUG, "unable to save verified headers to %s: %s\n",
+	   vc->path, strerror(errno));
+    if (fd >= 0)
+	close(fd);
+    unlink(tmppath);
+    free(tmppath);
+}
+
+/* Are results for this transaction set the ones cached? */
+static int sameContext(verifyCache vc, rpmts ts)
+{
+    rpmKeyring keyring = rpmtsGetKeyring(ts, 0);
+    int same = (keyring == vc->keyring && rpmtsVSFlags(ts) == vc->vsflags);
+    rpmKeyringFree(keyring);
+    return same;
+}
+
+verifyCache verifyCacheNew(const char *dir, rpmts ts)
+{
+    verifyCache vc = NULL;
+    rpmKeyring keyring;
+    char *keydigest;
+
+    if (dir == NULL || ts == NULL)
+	return NULL;
+
+    keyring = rpmtsGetKeyring(ts, 1);
+    keydigest = rpmKeyringDigest(keyring, VERIFYCACHE_ALGO);
+    if (keydigest == NULL) {
+	rpmKeyringFree(keyring);
+	return NULL;
+    }
+
+    vc = (verifyCache)xcalloc(1, sizeof(*vc));
+    vc->path = rstrscat(NULL, dir, "/.rpm.verified", NULL);
+    vc->keyring = keyring;
+    vc->keydigest = keydigest;
+    vc->vsflags = rpmtsVSFlags(ts);
+    rasprintf(&vc->context, "%s %x %s", rpmEVR, vc->vsflags, vc->keydigest);
+    vc->index = verifiedIndexCreate(1024, uintId, uintCmp, NULL, NULL);
+    cacheLoad(vc);
+
+    return vc;
+}
+
+verifyCache verifyCacheFree(verifyCache vc)
+{
+    if (vc) {
+	if (vc->dirty) {
+	    /* Keys may have come and gone since, don't mix the results up */
+	    char *keydigest = rpmKeyringDigest(vc->keyring, VERIFYCACHE_ALGO);
+	    if (keydigest && rstreq(keydigest, vc->keydigest))
+		cacheSave(vc);
+	    free(keydigest);
+	}
+
+	for (int i = 0; i < vc->nentries; i++)
+	    free(vc->entries[i].digest);
+	free(vc->entries);
+	verifiedIndexFree(vc->index);
+	rpmKeyringFree(vc->keyring);
+	free(vc->keydigest);
+	free(vc->context);
+	free(vc->path);
+	free(vc);
+    }
+    return NULL;
+}
+
+char *verifyCacheDigest(const void *uh, size_t uhlen)
+{
+    DIGEST_CTX ctx = rpmDigestInit(VERIFYCACHE_ALGO, RPMDIGEST_NONE);
+    char *digest = NULL;
+
+    rpmDigestUpdate(ctx, uh, uhlen);
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    return digest;
+}
+
+int verifyCacheGet(verifyCache vc, rpmts ts, unsigned int hdrNum,
+		   const char *digest)
+{
+    verifyEntry e;
+
+    if (vc == NULL || digest == NULL || !sameContext(vc, ts))
+	return 0;
+
+    e = findEntry(vc, hdrNum);
+    return (e && e->digest && rstreq(e->digest, digest));
+}
+
+void verifyCachePut(verifyCache vc, rpmts ts, unsigned int hdrNum,
+		    const char *digest)
+{
+    verifyEntry e;
+
+    if (vc == NULL || digest == NULL || !sameContext(vc, ts))
+	return;
+
+    e = findEntry(vc, hdrNum);
+    if (e == NULL)
+	e = addEntry(vc, hdrNum);
+    else if (e->digest && rstreq(e->digest, digest))
+	return;
+
+    free(e->digest);
+    e->digest = xstrdup(digest);
+    vc->dirty = 1;
+}
+
+void verifyCacheDel(verifyCache vc, unsigned int hdrNum)
+{
+    verifyEntry e = vc ? findEntry(vc, hdrNum) : NULL;
+
+    if (e && e->digest) {
+	e->digest = _free(e->digest);
+	vc->dirty = 1;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _VERIFYCACHE_H
+#define _VERIFYCACHE_H
+
+/** \ingroup rpmdb
+ * \file verifycache.h
+ * Cache of rpmdb headers verified by earlier processes
+ */
+
+#include <rpm/rpmtypes.h>
+#include <rpm/rpmutil.h>
+
+typedef struct verifyCache_s * verifyCache;
+
+/** \ingroup rpmdb
+ * Load the verified header cache of a database directory.
+ * Results are only valid for the verify flags and keyring of the
+ * transaction set, anything cached for others is dropped.
+ * @param dir		database directory
+ * @param ts		transaction set
+ * @return		verified header cache
+ */
+RPM_GNUC_INTERNAL
+verifyCache verifyCacheNew(const char *dir, rpmts ts);
+
+/** \ingroup rpmdb
+ * Save (if changed) and free a verified header cache.
+ * @param vc		verified header cache
+ * @return		NULL always
+ */
+RPM_GNUC_INTERNAL
+verifyCache verifyCacheFree(verifyCache vc);
+
+/** \ingroup rpmdb
+ * Return digest identifying a header blob in the cache.
+ * @param uh		header blob
+ * @param uhlen		header blob size
+ * @return		digest as hex string (malloc'ed)
+ */
+RPM_GNUC_INTERNAL
+char *verifyCacheDigest(const void *uh, size_t uhlen);
+
+/** \ingroup rpmdb
+ * Has the header been verified with the same flags and keyring before?
+ * @param vc		verified header cache
+ * @param ts		transaction set
+ * @param hdrNum	header instance in the database
+ * @param digest	header blob digest
+ * @return		1 if verified, 0 otherwise
+ */
+RPM_GNUC_INTERNAL
+int verifyCacheGet(verifyCache vc, rpmts ts, unsigned int hdrNum,
+		   const char *digest);
+
+/** \ingroup rpmdb
+ * Remember a header as verified.
+ * @param vc		verified header cache
+ * @param ts		transaction set
+ * @param hdrNum	header instance in the database
+ * @param digest	header blob digest
+ */
+RPM_GNUC_INTERNAL
+void verifyCachePut(verifyCache vc, rpmts ts, unsigned int hdrNum,
+		    const char *digest);
+
+/** \ingroup rpmdb
+ * Forget a header removed from the database.
+ * @param vc		verified header cache
+ * @param hdrNum	header instance in the database
+ */
+RPM_GNUC_INTERNAL
+void verifyCacheDel(verifyCache vc, unsigned int hdrNum);
+
+#endif /* _VERIFYCACHE_H */
@@ -0,0 +1,44 @@
+#ifndef _RPMELFDEPS_H
+#define _RPMELFDEPS_H
+
+/** \file misc/rpmelfdeps.h
+ * ELF soname and symbol version dependency extraction, shared between
+ * the elfdeps generator and the built-in generator of rpmbuild.
+ */
+
+#include <gelf.h>
+#include <rpm/argv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rpmElfdepsConfig_s {
+    int soname_only;		/*!< only soname deps, no symbol versions */
+    int fake_soname;		/*!< provide basename for DSOs without soname */
+    int filter_soname;		/*!< skip insane looking sonames */
+    int require_interp;		/*!< require the program interpreter */
+} rpmElfdepsConfig;
+
+#define RPMELFDEPS_CONFIG_INIT { 0, 1, 1, 0 }
+
+/** \ingroup rpmbuild
+ * Extract the dependencies of an already opened ELF file.
+ * @param elf		libelf handle of the file
+ * @param fn		path of the file (used for faked sonames)
+ * @param isExec	is the file executable?
+ * @param cfg		extraction options
+ * @param[out] provides	provides of the file (or NULL to skip)
+ * @param[out] requires	requires of the file (or NULL to skip)
+ * @return		0 on success, 1 if not an ELF file
+ */
+RPM_GNUC_INTERNAL
+int rpmElfdeps(Elf *elf, const char *fn, int isExec,
+		const rpmElfdepsConfig *cfg,
+		ARGV_t *provides, ARGV_t *requires);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RPMELFDEPS_H */
@@ -7,6 +7,11 @@
 #include <pthread.h>
 #include <errno.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #ifdef HAVE_SCHED_GETAFFINITY
 #include <sched.h>
 #endif
@@ -27,12 +32,22 @@
 #include <rpm/rpmurl.h>
 #include <rpm/rpmlog.h>
 #include <rpm/rpmmacro.h>
+#include <rpm/rpmcrypto.h>
 #include <rpm/argv.h>
 
 #include "rpmlua.h"
 #include "rpmmacro_internal.h"
 #include "debug.h"
 
+#define HASHTYPE shellCache
+#define HTKEYTYPE const char *
+#define HTDATATYPE const char *
+#include "rpmhash.H"
+#include "rpmhash.C"
+#undef HASHTYPE
+#undef HTKEYTYPE
+#undef HTDATATYPE
+
 enum macroFlags_e {
     ME_NONE	= 0,
     ME_AUTO	= (1 << 0),
@@ -41,8 +56,28 @@ enum macroFlags_e {
     ME_PARSE	= (1 << 3),
     ME_FUNC	= (1 << 4),
     ME_QUOTED	= (1 << 5),
+    ME_PURE	= (1 << 6),
 };
 
+/*! A macro call in a string, with offsets relative to the string start. */
+typedef struct macroCall_s {
+    ptrdiff_t pos;	/*!< Start of call, after the % */
+    ptrdiff_t s;	/*!< Start of %name (past any ?!), or pos */
+    ptrdiff_t se;	/*!< End of call (-1 if unterminated) */
+    ptrdiff_t f, fe;	/*!< Macro name */
+    ptrdiff_t g, ge;	/*!< Argument of %{name:arg} (or -1) */
+    ptrdiff_t lastc;	/*!< End of arguments of "%name args" (or -1) */
+    int negate;		/*!< %{!name}? */
+    int chkexist;	/*!< %{?name}? */
+} * macroCall;
+
+/*! The macro calls of a macro body, parsed once and reused. */
+typedef struct macroPlan_s {
+    int nrefs;		/*!< Reference count */
+    int ncalls;		/*!< No. of calls */
+    struct macroCall_s calls[];	/*!< Calls in order of position */
+} * macroPlan;
+
 /*! The structure used to store a macro. */
 struct rpmMacroEntry_s {
     struct rpmMacroEntry_s *prev;/*!< Macro entry stack. */
@@ -54,6 +89,7 @@ struct rpmMacroEntry_s {
     int nargs;		/*!< Number of required args */
     int flags;		/*!< Macro state bits. */
     int level;          /*!< Scoping level. */
+    macroPlan plan;	/*!< Parsed macro calls in body (or NULL) */
     char arena[];   	/*!< String arena. */
 };
 
@@ -61,6 +97,8 @@ struct rpmMacroEntry_s {
 struct rpmMacroContext_s {
     rpmMacroEntry *tab;  /*!< Macro entry table (array of pointers). */
     int n;      /*!< No. of macros. */
+    unsigned int *index; /*!< Hash index into table (slot + 1, 0 if free) */
+    unsigned int nindex; /*!< No. of index buckets (power of 2) */
     int depth;		 /*!< Depth tracking on external recursion */
     int level;		 /*!< Scope level tracking when on external recursion */
     pthread_mutex_t lock;
@@ -110,6 +148,7 @@ struct rpmMacroBuf_s {
     int macro_trace;		/*!< Pre-print macro to expand? */
     int expand_trace;		/*!< Post-print macro expansion? */
     int flags;			/*!< Flags to control behavior */
+    int pure;			/*!< Expanding a pure macro? */
     rpmMacroEntry me;		/*!< Current macro (or NULL if anonymous) */
     ARGV_t args;		/*!< Current macro arguments (or NULL) */
     rpmMacroContext mc;
@@ -135,6 +174,8 @@ static int print_expand_trace = _PRINT_EXPAND_TRACE;
 
 /* forward ref */
 static int expandMacro(rpmMacroBuf mb, const char *src, size_t slen);
+static int expandMacroPlan(rpmMacroBuf mb, const char *src, size_t slen,
+			   macroPlan plan);
 static int expandQuotedMacro(rpmMacroBuf mb, const char *src);
 static void pushMacro(rpmMacroContext mc,
 	const char * n, const char * o, const char * b, int level, int flags);
@@ -157,67 +198,160 @@ static rpmMacroContext rpmmctxRelease(rpmMacroContext mc)
     return NULL;
 }
 
+/*
+ * The macro table is kept in no particular order, with an open addressing
+ * hash index on the macro names. Names are stored once per definition
+ * stack, in the entry at the bottom of it.
+ */
+static unsigned int nameHash(const char *name, size_t namelen)
+{
+    /* FNV-1a */
+    unsigned int h = 2166136261U;
+    for (size_t i = 0; i < namelen; i++) {
+	h ^= (unsigned char)name[i];
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/* Return index bucket of name, or the free bucket where it would go */
+static unsigned int *
+findBucket(rpmMacroContext mc, const char *name, size_t namelen)
+{
+    unsigned int mask = mc->nindex - 1;
+    unsigned int h = nameHash(name, namelen) & mask;
+
+    while (mc->index[h]) {
+	rpmMacroEntry me = mc->tab[mc->index[h] - 1];
+	if (strncmp(me->name, name, namelen) == 0 && me->name[namelen] == '\0')
+	    break;
+	h = (h + 1) & mask;
+    }
+    return &mc->index[h];
+}
+
+static void growIndex(rpmMacroContext mc)
+{
+    free(mc->index);
+    mc->nindex = mc->nindex ? mc->nindex * 2 : 512;
+    mc->index = (unsigned int *)xcalloc(mc->nindex, sizeof(*mc->index));
+    for (int i = 0; i < mc->n; i++) {
+	const char *name = mc->tab[i]->name;
+	*findBucket(mc, name, strlen(name)) = i + 1;
+    }
+}
+
 /**
  * Find entry in macro table.
  * @param mc		macro context
  * @param name		macro name
  * @param namelen	no. of bytes
- * @param pos		found/insert position
+ * @param pos		found position
  * @return		address of slot in macro table with name (or NULL)
  */
 static rpmMacroEntry *
 findEntry(rpmMacroContext mc, const char *name, size_t namelen, size_t *pos)
 {
-    /* bsearch */
-    int cmp = 1;
-    size_t l = 0;
-    size_t u = mc->n;
-    size_t i = 0;
-    while (l < u) {
-	i = (l + u) / 2;
-	rpmMacroEntry me = mc->tab[i];
-	if (namelen == 0)
-	    cmp = strcmp(me->name, name);
-	else {
-	    cmp = strncmp(me->name, name, namelen);
-	    /* longer me->name compares greater */
-	    if (cmp == 0)
-		cmp = (me->name[namelen] != '\0');
-	}
-	if (cmp < 0)
-	    l = i + 1;
-	else if (cmp > 0)
-	    u = i;
-	else
-	    break;
-    }
+    unsigned int *b;
 
+    if (mc->n == 0)
+	return NULL;
+    if (namelen == 0)
+	namelen = strlen(name);
+
+    b = findBucket(mc, name, namelen);
+    if (*b == 0)
+	return NULL;
     if (pos)
-	*pos = (cmp < 0) ? i + 1 : i;
-    if (cmp == 0)
-	return &mc->tab[i];
-    return NULL;
+	*pos = *b - 1;
+    return &mc->tab[*b - 1];
 }
 
 /**
  * Create a new entry in the macro table.
  * @param mc		macro context
- * @param pos		insert position
+ * @param name		macro name (not in table)
  * @return		address of slot in macro table
  */
 static rpmMacroEntry *
-newEntry(rpmMacroContext mc, size_t pos)
+newEntry(rpmMacroContext mc, const char *name)
 {
-    /* extend macro table */
+    /* extend macro table, keeping the index at most half full */
     const int delta = 256;
     if (mc->n % delta == 0)
 	mc->tab = xrealloc(mc->tab, sizeof(rpmMacroEntry) * (mc->n + delta));
-    /* shift pos+ entries to the right */
-    memmove(mc->tab + pos + 1, mc->tab + pos, sizeof(rpmMacroEntry) * (mc->n - pos));
-    mc->n++;
+    if (2 * (mc->n + 1) > mc->nindex)
+	growIndex(mc);
+    *findBucket(mc, name, strlen(name)) = mc->n + 1;
     /* make slot */
-    mc->tab[pos] = NULL;
-    return &mc->tab[pos];
+    mc->tab[mc->n] = NULL;
+    return &mc->tab[mc->n++];
+}
+
+/**
+ * Remove an empty slot from the macro table. The last slot is moved
+ * into its place.
+ * @param mc		macro context
+ * @param name		macro name of the slot
+ * @param pos		slot position
+ */
+static void
+delEntry(rpmMacroContext mc, const char *name, size_t pos)
+{
+    unsigned int mask = mc->nindex - 1;
+    unsigned int *b = findBucket(mc, name, strlen(name));
+    unsigned int i = b - mc->index;
+    unsigned int j = i;
+
+    /* shift back the entries that probed past the freed bucket */
+    for (;;) {
+	j = (j + 1) & mask;
+	if (mc->index[j] == 0)
+	    break;
+	const char *jname = mc->tab[mc->index[j] - 1]->name;
+	unsigned int k = nameHash(jname, strlen(jname)) & mask;
+	if ((i < j) ? (k <= i || k > j) : (k <= i && k > j)) {
+	    mc->index[i] = mc->index[j];
+	    i = j;
+	}
+    }
+    mc->index[i] = 0;
+
+    mc->n--;
+    if (pos != (size_t)mc->n) {
+	const char *lname = mc->tab[mc->n]->name;
+	mc->tab[pos] = mc->tab[mc->n];
+	*findBucket(mc, lname, strlen(lname)) = pos + 1;
+    }
+
+    /* deallocate */
+    if (mc->n == 0) {
+	mc->tab = _free(mc->tab);
+	mc->index = _free(mc->index);
+	mc->nindex = 0;
+    }
+}
+
+static int entryCmp(const void *a, const void *b)
+{
+    rpmMacroEntry mea = *(const rpmMacroEntry *)a;
+    rpmMacroEntry meb = *(const rpmMacroEntry *)b;
+    return strcmp(mea->name, meb->name);
+}
+
+/**
+ * Return the macro table sorted by name.
+ * @param mc		macro context
+ * @return		copy of macro table (malloc'ed)
+ */
+static rpmMacroEntry *
+sortedEntries(rpmMacroContext mc)
+{
+    rpmMacroEntry *tab = xmalloc(sizeof(*tab) * (mc->n + 1));
+    if (mc->n)
+	memcpy(tab, mc->tab, sizeof(*tab) * mc->n);
+    qsort(tab, mc->n, sizeof(*tab), entryCmp);
+    return tab;
 }
 
 /* =============================================================== */
@@ -525,6 +659,18 @@ void rpmMacroBufAppend(rpmMacroBuf mb, char c)
     mb->nb--;
 }
 
+static void mbAppendLen(rpmMacroBuf mb, const char *str, size_t len)
+{
+    if (len > mb->nb) {
+	mb->buf = xrealloc(mb->buf, mb->tpos + mb->nb + MACROBUFSIZ + len + 1);
+	mb->nb += MACROBUFSIZ + len;
+    }
+    memcpy(mb->buf+mb->tpos, str, len);
+    mb->tpos += len;
+    mb->buf[mb->tpos] = '\0';
+    mb->nb -= len;
+}
+
 void rpmMacroBufAppendStr(rpmMacroBuf mb, const char *str)
 {
     size_t len = strlen(str);
@@ -563,6 +709,132 @@ static void doDnl(rpmMacroBuf mb, rpmMacroEntry me, ARGV_t argv, size_t *parsed)
 	*parsed += end - start;
 }
 
+/*
+ * Output of shell escapes in pure macros, by expanded command. This is
+ * per process, shared by all macro contexts. The output can also be kept
+ * in a directory for later invocations, one file per command, named by
+ * a digest of it.
+ */
+static shellCache shellOutputs = NULL;
+static pthread_mutex_t shellOutputsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *shellCachePath(rpmMacroBuf mb, const char *cmd, time_t *ttl)
+{
+    char *dir = NULL, *ttlstr = NULL, *digest = NULL, *path = NULL;
+    DIGEST_CTX ctx;
+
+    expandThis(mb, "%{?_pure_shell_cache}", 0, &dir, NULL);
+    if (dir == NULL || *dir == '\0')
+	goto exit;
+    if (rpmioMkpath(dir, 0755, -1, -1))
+	goto exit;
+
+    expandThis(mb, "%{?_pure_shell_cache_ttl}", 0, &ttlstr, NULL);
+    *ttl = ttlstr ? strtol(ttlstr, NULL, 10) : 0;
+
+    ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    rpmDigestUpdate(ctx, cmd, strlen(cmd));
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    path = rstrscat(NULL, dir, "/", digest, NULL);
+
+exit:
+    free(digest);
+    free(ttlstr);
+    free(dir);
+    return path;
+}
+
+static char *shellCacheRead(const char *path, time_t ttl)
+{
+    FILE *f = fopen(path, "r");
+    struct stat st;
+    char *out = NULL;
+
+    if (f == NULL)
+	return NULL;
+    if (fstat(fileno(f), &st) == 0 &&
+	    (ttl <= 0 || time(NULL) - st.st_mtime < ttl)) {
+	out = (char *)xmalloc(st.st_size + 1);
+	if (fread(out, 1, st.st_size, f) == (size_t)st.st_size) {
+	    out[st.st_size] = '\0';
+	} else {
+	    out = _free(out);
+	}
+    }
+    fclose(f);
+    return out;
+}
+
+static void shellCacheWrite(const char *path, const char *out)
+{
+    char *tmppath = rstrscat(NULL, path, ".XXXXXX", NULL);
+    int fd = mkstemp(tmppath);
+    FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    int rc = -1;
+
+    if (f) {
+	(void) fchmod(fd, 0644);
+	fputs(out, f);
+	rc = (ferror(f) | fclose(f)) ? -1 : rename(tmppath, path);
+    } else if (fd >= 0) {
+	close(fd);
+    }
+    if (rc) {
+	rpmlog(RPMLOG_DEBUG, "unable to save shell output %s: %s\n",
+	       path, strerror(errno));
+	if (fd >= 0)
+	    unlink(tmppath);
+    }
+    free(tmppath);
+}
+
+/* Return the cached output of a command, or NULL */
+static char *shellCacheGet(rpmMacroBuf mb, const char *cmd)
+{
+    const char **outs = NULL;
+    char *out = NULL;
+    char *path;
+    time_t ttl = 0;
+
+    pthread_mutex_lock(&shellOutputsLock);
+    if (shellOutputs && shellCacheGetEntry(shellOutputs, cmd, &outs, NULL, NULL))
+	out = xstrdup(outs[0]);
+    pthread_mutex_unlock(&shellOutputsLock);
+
+    if (out == NULL && (path = shellCachePath(mb, cmd, &ttl)) != NULL) {
+	if ((out = shellCacheRead(path, ttl)) != NULL) {
+	    pthread_mutex_lock(&shellOutputsLock);
+	    if (shellOutputs == NULL)
+		shellOutputs = shellCacheCreate(64, rstrhash, strcmp,
+				(shellCacheFreeKey)free, (shellCacheFreeData)free);
+	    if (!shellCacheHasEntry(shellOutputs, cmd))
+		shellCacheAddEntry(shellOutputs, xstrdup(cmd), xstrdup(out));
+	    pthread_mutex_unlock(&shellOutputsLock);
+	}
+	free(path);
+    }
+    return out;
+}
+
+static void shellCachePut(rpmMacroBuf mb, const char *cmd, const char *out)
+{
+    char *path;
+    time_t ttl = 0;
+
+    pthread_mutex_lock(&shellOutputsLock);
+    if (shellOutputs == NULL)
+	shellOutputs = shellCacheCreate(64, rstrhash, strcmp,
+				(shellCacheFreeKey)free, (shellCacheFreeData)free);
+    if (!shellCacheHasEntry(shellOutputs, cmd))
+	shellCacheAddEntry(shellOutputs, xstrdup(cmd), xstrdup(out));
+    pthread_mutex_unlock(&shellOutputsLock);
+
+    if ((path = shellCachePath(mb, cmd, &ttl)) != NULL) {
+	shellCacheWrite(path, out);
+	free(path);
+    }
+}
+
 /**
  * Expand output of shell command into target buffer.
  * @param mb		macro expansion state
@@ -573,13 +845,21 @@ static void
 doShellEscape(rpmMacroBuf mb, const char * cmd, size_t clen)
 {
     char *buf = NULL;
+    char *out = NULL;
     FILE *shf;
     int c;
+    int status;
     size_t tpos;
 
     if (expandThis(mb, cmd, clen, &buf, NULL))
 	goto exit;
 
+    /* Output of commands in pure macros only depends on the command */
+    if (mb->pure && (out = shellCacheGet(mb, buf)) != NULL) {
+	rpmMacroBufAppendStr(mb, out);
+	goto exit;
+    }
+
     if ((shf = popen(buf, "r")) == NULL) {
 	rpmMacroBufErr(mb, 1, _("Failed to open shell expansion pipe for command: "
 		"%s: %m \n"), buf);
@@ -590,7 +870,7 @@ doShellEscape(rpmMacroBuf mb, const char * cmd, size_t clen)
     while ((c = fgetc(shf)) != EOF) {
 	rpmMacroBufAppend(mb, c);
     }
-    (void) pclose(shf);
+    status = pclose(shf);
 
     /* Delete trailing \r \n */
     while (mb->tpos > tpos && iseol(mb->buf[mb->tpos-1])) {
@@ -598,7 +878,13 @@ doShellEscape(rpmMacroBuf mb, const char * cmd, size_t clen)
 	mb->nb++;
     }
 
+    /* Failures may well be transient, don't make them stick */
+    if (mb->pure && status != -1 && WIFEXITED(status) &&
+	    WEXITSTATUS(status) == 0)
+	shellCachePut(mb, buf, mb->buf + tpos);
+
 exit:
+    _free(out);
     _free(buf);
 }
 
@@ -697,6 +983,13 @@ doDefine(rpmMacroBuf mb, const char * se, int level, int expandbody, size_t *par
     int rc = 1; /* assume failure */
     int flags = ME_NONE;
 
+    /* Shell output of pure macros only depends on the command */
+    SKIPBLANK(s, c);
+    if (s[0] == '-' && s[1] == 'p' && isblank(s[2])) {
+	flags |= ME_PURE;
+	s += 2;
+    }
+
     /* Copy name */
     COPYNAME(ne, s, c);
 
@@ -793,7 +1086,12 @@ doDefine(rpmMacroBuf mb, const char * se, int level, int expandbody, size_t *par
 
     if (expandbody) {
 	int eflags = RPMEXPAND_KEEP_QUOTED;
-	if (expandThis(mb, b, 0, &ebody, &eflags)) {
+	int pure = mb->pure;
+	if (flags & ME_PURE)
+	    mb->pure = 1;
+	rc = expandThis(mb, b, 0, &ebody, &eflags);
+	mb->pure = pure;
+	if (rc) {
 	    rpmMacroBufErr(mb, 1, _("Macro %%%s failed to expand\n"), n);
 	    goto exit;
 	}
@@ -1485,6 +1783,136 @@ const char *findMacroEnd(const char *str)
     return str;
 }
 
+/**
+ * Parse a macro call.
+ * @param src		string containing the call
+ * @param s		pointer to the character after the initial '%'
+ * @param call		parsed call
+ */
+static void parseMacroCall(const char *src, const char *s, macroCall call)
+{
+    const char *se, *f = NULL, *fe = NULL, *g = NULL, *ge = NULL;
+    const char *lastc = NULL;
+    int c;
+
+    memset(call, 0, sizeof(*call));
+    call->pos = call->s = s - src;
+    call->se = call->f = call->fe = call->g = call->ge = call->lastc = -1;
+
+    if ((se = findMacroEnd(s)) == NULL)
+	return;
+
+    switch (*s) {
+    default:		/* %name substitution */
+	f = s = setNegateAndCheck(s, &call->negate, &call->chkexist);
+	fe = se;
+	/* For "%name " macros ... */
+	if ((c = *fe) && isblank(c))
+	    if ((lastc = strchr(fe,'\n')) == NULL)
+		lastc = strchr(fe, '\0');
+	break;
+    case '(':		/* %(...) shell escape */
+    case '[':		/* %[...] expression expansion */
+	break;
+    case '{':		/* %{...}/%{...:...} substitution */
+	f = s+1;	/* skip { */
+	f = setNegateAndCheck(f, &call->negate, &call->chkexist);
+	for (fe = f; (c = *fe) && !strchr(" :}", c);)
+	    fe++;
+	switch (c) {
+	case ':':
+	    g = fe + 1;
+	    ge = se - 1;
+	    break;
+	case ' ':
+	    lastc = se-1;
+	    break;
+	default:
+	    break;
+	}
+	break;
+    }
+
+    call->s = s - src;
+    call->se = se - src;
+    if (f) {
+	call->f = f - src;
+	call->fe = fe - src;
+    }
+    if (g) {
+	call->g = g - src;
+	call->ge = ge - src;
+    }
+    if (lastc)
+	call->lastc = lastc - src;
+}
+
+/**
+ * Parse all macro calls in a macro body. Expanding a macro can skip
+ * over some of them, but what's found at a position only depends on the
+ * text that follows, so a lookup by position always finds the right call.
+ * @param body		macro body
+ * @return		parsed calls (or NULL if there are none)
+ */
+static macroPlan compileMacroBody(const char *body)
+{
+    macroPlan plan = NULL;
+    int nalloced = 0;
+    const char *p = body;
+
+    while ((p = strchr(p, '%')) != NULL) {
+	p++;
+	if (*p == '%') {	/* %% */
+	    p++;
+	    continue;
+	}
+	if (*p == '\0')
+	    break;
+	if (plan == NULL || plan->ncalls == nalloced) {
+	    nalloced += 8;
+	    plan = xrealloc(plan, sizeof(*plan) +
+				nalloced * sizeof(*plan->calls));
+	    if (nalloced == 8)
+		plan->ncalls = 0;
+	}
+	macroCall call = &plan->calls[plan->ncalls++];
+	parseMacroCall(body, p, call);
+	if (call->se < 0)
+	    break;
+	p = body + call->se;
+    }
+    if (plan)
+	plan->nrefs = 1;
+    return plan;
+}
+
+static macroPlan planLink(macroPlan plan)
+{
+    if (plan)
+	plan->nrefs++;
+    return plan;
+}
+
+static macroPlan planFree(macroPlan plan)
+{
+    if (plan && --plan->nrefs == 0)
+	free(plan);
+    return NULL;
+}
+
+/* Find the call parsed at position pos, starting from the call at *ix */
+static const struct macroCall_s *
+planLookup(macroPlan plan, int *ix, ptrdiff_t pos)
+{
+    if (plan == NULL)
+	return NULL;
+    while (*ix < plan->ncalls && plan->calls[*ix].pos < pos)
+	(*ix)++;
+    if (*ix < plan->ncalls && plan->calls[*ix].pos == pos)
+	return &plan->calls[*ix];
+    return NULL;
+}
+
 /**
  * Expand a single macro entry
  * @param mb		macro expansion state
@@ -1497,8 +1925,12 @@ doMacro(rpmMacroBuf mb, rpmMacroEntry me, ARGV_t args, size_t *parsed)
 {
     rpmMacroEntry prevme = mb->me;
     ARGV_t prevarg = mb->args;
+    int prevpure = mb->pure;
     size_t old_tpos = mb->tpos;
 
+    if (me->flags & ME_PURE)
+	mb->pure = 1;
+
     /* Recursively expand body of macro */
     if (me->flags & ME_FUNC) {
 	int nargs = args && args[0] ? (argvCount(args) - 1) : 0;
@@ -1517,10 +1949,16 @@ doMacro(rpmMacroBuf mb, rpmMacroEntry me, ARGV_t args, size_t *parsed)
 	/* Setup args for "%name " macros with opts */
 	if (args != NULL)
 	    setupArgs(mb, me, args);
-	if ((me->flags & ME_QUOTED) && (mb->flags & RPMEXPAND_KEEP_QUOTED) != 0)
+	if ((me->flags & ME_QUOTED) && (mb->flags & RPMEXPAND_KEEP_QUOTED) != 0) {
 	    expandQuotedMacro(mb, me->body);
-	else
-	    expandMacro(mb, me->body, 0);
+	} else {
+	    /* The body may go away during expansion, and the plan with it */
+	    if (me->plan == NULL)
+		me->plan = compileMacroBody(me->body);
+	    macroPlan plan = planLink(me->plan);
+	    expandMacroPlan(mb, me->body, 0, plan);
+	    planFree(plan);
+	}
 	/* Free args for "%name " macros with opts */
 	if (args != NULL)
 	    freeArgs(mb);
@@ -1537,6 +1975,7 @@ doMacro(rpmMacroBuf mb, rpmMacroEntry me, ARGV_t args, size_t *parsed)
 exit:
     mb->args = prevarg;
     mb->me = prevme;
+    mb->pure = prevpure;
 }
 
 /**
@@ -1575,7 +2014,7 @@ expandQuotedMacro(rpmMacroBuf mb, const char *src)
  * @return		0 on success, 1 on failure
  */
 static int
-expandMacro(rpmMacroBuf mb, const char *src, size_t slen)
+expandMacroPlan(rpmMacroBuf mb, const char *src, size_t slen, macroPlan plan)
 {
     rpmMacroEntry *mep;
     rpmMacroEntry me = NULL;
@@ -1589,6 +2028,9 @@ expandMacro(rpmMacroBuf mb, const char *src, size_t slen)
     int chkexist;
     char *source = NULL;
     MacroExpansionData med;
+    struct macroCall_s parsed;
+    const struct macroCall_s *call;
+    int ix = 0;
 
     /*
      * Always make a (terminated) copy of the source string.
@@ -1605,41 +2047,45 @@ expandMacro(rpmMacroBuf mb, const char *src, size_t slen)
 	goto exit;
 
     while (mb->error == 0 && (c = *s) != '\0') {
-	s++;
 	/* Copy text until next macro */
-	switch (c) {
-	case '%':
-	    if (*s) {	/* Ensure not end-of-string. */
-		if (*s != '%')
-		    break;
+	if (c != '%') {
+	    size_t n = strcspn(s, "%");
+	    mbAppendLen(mb, s, n);
+	    s += n;
+	    continue;
+	}
+	s++;
+	if (*s == '\0' || *s == '%') {
+	    if (*s)
 		s++;	/* skip first % in %% */
-	    }
-	default:
 	    rpmMacroBufAppend(mb, c);
 	    continue;
-	    break;
 	}
 
 	/* Expand next macro */
-	f = fe = NULL;
-	g = ge = NULL;
 	if (mb->depth > 1)	/* XXX full expansion for outermost level */
 	    med.tpos = mb->tpos;	/* save expansion pointer for printExpand */
-	lastc = NULL;
-	if ((se = findMacroEnd(s)) == NULL) {
+	if ((call = planLookup(plan, &ix, s - source)) == NULL) {
+	    parseMacroCall(source, s, &parsed);
+	    call = &parsed;
+	}
+	if (call->se < 0) {
 	    rpmMacroBufErr(mb, 1, _("Unterminated %c: %s\n"), (char)*s, s);
 	    continue;
 	}
 
+#define CALLPTR(_off) ((_off) >= 0 ? source + (_off) : NULL)
+	se = CALLPTR(call->se);
+	f = CALLPTR(call->f);
+	fe = CALLPTR(call->fe);
+	g = CALLPTR(call->g);
+	ge = CALLPTR(call->ge);
+	lastc = CALLPTR(call->lastc);
+	negate = call->negate;
+	chkexist = call->chkexist;
+#undef CALLPTR
+
 	switch (*s) {
-	default:		/* %name substitution */
-	    f = s = setNegateAndCheck(s, &negate, &chkexist);
-	    fe = se;
-	    /* For "%name " macros ... */
-	    if ((c = *fe) && isblank(c))
-		if ((lastc = strchr(fe,'\n')) == NULL)
-		    lastc = strchr(fe, '\0');
-	    break;
 	case '(':		/* %(...) shell escape */
 	    if (mb->macro_trace)
 		printMacro(mb, s, se);
@@ -1654,22 +2100,8 @@ expandMacro(rpmMacroBuf mb, const char *src, size_t slen)
 	    doExpressionExpansion(mb, s, (se - 1 - s));
 	    s = se;
 	    continue;
-	case '{':		/* %{...}/%{...:...} substitution */
-	    f = s+1;	/* skip { */
-	    f = setNegateAndCheck(f, &negate, &chkexist);
-	    for (fe = f; (c = *fe) && !strchr(" :}", c);)
-		fe++;
-	    switch (c) {
-	    case ':':
-		g = fe + 1;
-		ge = se - 1;
-		break;
-	    case ' ':
-		lastc = se-1;
-		break;
-	    default:
-		break;
-	    }
+	default:
+	    s = source + call->s;
 	    break;
 	}
 
@@ -1769,6 +2201,12 @@ exit:
     return mb->error;
 }
 
+static int
+expandMacro(rpmMacroBuf mb, const char *src, size_t slen)
+{
+    return expandMacroPlan(mb, src, slen, NULL);
+}
+
 /**
  * Expand a single macro
  * @param mb		macro expansion state
@@ -1850,8 +2288,7 @@ static void pushMacroAny(rpmMacroContext mc,
     size_t blen = b ? strlen(b) : 0;
     size_t mesize = sizeof(*me) + blen + 1 + (olen ? olen + 1 : 0);
 
-    size_t pos;
-    rpmMacroEntry *mep = findEntry(mc, n, 0, &pos);
+    rpmMacroEntry *mep = findEntry(mc, n, 0, NULL);
     if (mep) {
 	/* entry with shared name */
 	me = (rpmMacroEntry)xmalloc(mesize);
@@ -1861,7 +2298,7 @@ static void pushMacroAny(rpmMacroContext mc,
     }
     else {
 	/* entry with new name */
-	mep = newEntry(mc, pos);
+	mep = newEntry(mc, n);
 	size_t nlen = strlen(n);
 	me = (rpmMacroEntry)xmalloc(mesize + nlen + 1);
 	p = me->arena;
@@ -1889,6 +2326,7 @@ static void pushMacroAny(rpmMacroContext mc,
     me->flags = flags;
     me->flags &= ~(ME_USED);
     me->level = level;
+    me->plan = NULL;
     /* push over previous definition */
     me->prev = *mep;
     *mep = me;
@@ -1911,17 +2349,13 @@ static rpmMacroEntry popMacro(rpmMacroContext mc, const char * n)
     rpmMacroEntry me = *mep;
     assert(me);
     /* detach/pop definition */
-    rpmMacroEntry prev = mc->tab[pos] = me->prev;
-    /* shrink macro table */
-    if (me->prev == NULL) {
-	mc->n--;
-	/* move pos+ elements to the left */
-	memmove(mc->tab + pos, mc->tab + pos + 1, sizeof(me) * (mc->n - pos));
-	/* deallocate */
-	if (mc->n == 0)
-	    mc->tab = _free(mc->tab);
-    }
-    /* comes in a single chunk */
+    rpmMacroEntry prev = me->prev;
+    if (prev)
+	mc->tab[pos] = prev;
+    else
+	delEntry(mc, me->name, pos);	/* shrink macro table */
+    /* comes in a single chunk, apart from the plan */
+    planFree(me->plan);
     free(me);
     return prev;
 }
@@ -2054,9 +2488,10 @@ rpmDumpMacroTable(rpmMacroContext mc, FILE * fp)
     mc = rpmmctxAcquire(mc);
     if (fp == NULL) fp = stderr;
     
+    rpmMacroEntry *tab = sortedEntries(mc);
     fprintf(fp, "========================\n");
     for (int i = 0; i < mc->n; i++) {
-	rpmMacroEntry me = mc->tab[i];
+	rpmMacroEntry me = tab[i];
 	assert(me);
 	fprintf(fp, "%3d%c %s", me->level,
 		    ((me->flags & ME_USED) ? '=' : ':'), me->name);
@@ -2068,7 +2503,41 @@ rpmDumpMacroTable(rpmMacroContext mc, FILE * fp)
     }
     fprintf(fp, _("======================== active %d empty %d\n"),
 		mc->n, 0);
+    free(tab);
+    rpmmctxRelease(mc);
+}
+
+static void digestStr(DIGEST_CTX ctx, const char *s)
+{
+    /* Include the terminator to keep the fields apart */
+    if (s == NULL)
+	s = "";
+    rpmDigestUpdate(ctx, s, strlen(s) + 1);
+}
+
+char *rpmMacroContextDigest(rpmMacroContext mc, int algo)
+{
+    DIGEST_CTX ctx = rpmDigestInit(algo, RPMDIGEST_NONE);
+    char *digest = NULL;
+
+    mc = rpmmctxAcquire(mc);
+    rpmMacroEntry *tab = sortedEntries(mc);
+    for (int i = 0; i < mc->n; i++) {
+	/* Shadowed definitions come back into effect on pop */
+	for (rpmMacroEntry me = tab[i]; me; me = me->prev) {
+	    int flags = me->flags & ~ME_USED;
+	    digestStr(ctx, me->name);
+	    digestStr(ctx, me->opts);
+	    digestStr(ctx, me->body);
+	    rpmDigestUpdate(ctx, &me->level, sizeof(me->level));
+	    rpmDigestUpdate(ctx, &flags, sizeof(flags));
+	}
+    }
+    free(tab);
     rpmmctxRelease(mc);
+
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    return digest;
 }
 
 int rpmPushMacroFlags(rpmMacroContext mc,
@@ -2173,29 +2642,20 @@ rpmLoadMacroFile(rpmMacroContext mc, const char * fn)
     return rc;
 }
 
-void
-rpmInitMacros(rpmMacroContext mc, const char * macrofiles)
+/* Glob expand the macro path, expanding ~ to $HOME. */
+static ARGV_t macroFiles(const char *macrofiles)
 {
     ARGV_t pattern, globs = NULL;
-    rpmMacroContext climc;
-    mc = rpmmctxAcquire(mc);
-
-    /* Define built-in macros */
-    for (const struct builtins_s *b = builtinmacros; b->name; b++) {
-	pushMacroAny(mc, b->name, b->nargs ? "" : NULL, "<builtin>",
-		    b->func, NULL, b->nargs, RMIL_BUILTIN, b->flags | ME_FUNC);
-    }
+    ARGV_t macrofns = NULL;
 
     argvSplit(&globs, macrofiles, ":");
     for (pattern = globs; pattern && *pattern; pattern++) {
 	ARGV_t path, files = NULL;
     
-	/* Glob expand the macro file path element, expanding ~ to $HOME. */
 	if (rpmGlob(*pattern, NULL, &files) != 0) {
 	    continue;
 	}
 
-	/* Read macros from each file. */
 	for (path = files; *path; path++) {
 	    size_t len = strlen(*path);
 	    if (rpmFileHasSuffix(*path, ".rpmnew") || 
@@ -2204,11 +2664,258 @@ rpmInitMacros(rpmMacroContext mc, const char * macrofiles)
 		(len > 0 && !risalnum((*path)[len - 1]))) {
 		continue;
 	    }
-	    (void) loadMacroFile(mc, *path);
+	    argvAdd(&macrofns, *path);
 	}
 	argvFree(files);
     }
     argvFree(globs);
+    return macrofns;
+}
+
+#define SNAPSHOT_MAGIC "rpm-macro-snapshot 1"
+/* Flags of plain definitions, the others are internal to rpm */
+#define SNAPSHOT_FLAGS (ME_LITERAL | ME_QUOTED | ME_PURE)
+
+/*
+ * A macro snapshot holds the definitions made by loading the macro files,
+ * in the order they need to be pushed. It's valid as long as the version,
+ * the macro path and the files it expands to are the same, as far as
+ * stat() can tell. All strings are stored length-prefixed and NUL
+ * terminated so they can be used from the mapped file directly.
+ */
+static char *snapshotKey(const char *macrofiles, ARGV_const_t files)
+{
+    char *key = rstrscat(NULL, SNAPSHOT_MAGIC, "\n", VERSION, "\n",
+			 macrofiles, "\n", NULL);
+
+    for (ARGV_const_t fn = files; fn && *fn; fn++) {
+	struct stat st;
+	char *line = NULL;
+	if (stat(*fn, &st)) {
+	    free(key);
+	    return NULL;
+	}
+	rasprintf(&line, "%s\t%ju\t%ju\t%jd\t%jd.%09ld\n", *fn,
+		  (uintmax_t)st.st_dev, (uintmax_t)st.st_ino,
+		  (intmax_t)st.st_size, (intmax_t)st.st_mtim.tv_sec,
+		  st.st_mtim.tv_nsec);
+	key = rstrcat(&key, line);
+	free(line);
+    }
+    return key;
+}
+
+/*
+ * Snapshots of different macro paths, such as those of different users,
+ * go to files of their own named after a digest of the path.
+ */
+static char *snapshotPath(const char *snapshot, const char *macrofiles,
+			  ARGV_const_t files)
+{
+    DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+    char *digest = NULL;
+    char *path = NULL;
+
+    rpmDigestUpdate(ctx, macrofiles, strlen(macrofiles) + 1);
+    for (ARGV_const_t fn = files; fn && *fn; fn++)
+	rpmDigestUpdate(ctx, *fn, strlen(*fn) + 1);
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+
+    path = rstrscat(NULL, snapshot, "-", digest, NULL);
+    free(digest);
+    return path;
+}
+
+static void snapWriteStr(FILE *f, const char *s)
+{
+    uint32_t len = s ? strlen(s) : UINT32_MAX;
+    fwrite(&len, sizeof(len), 1, f);
+    if (s)
+	fwrite(s, 1, len + 1, f);
+}
+
+static const char *snapReadStr(const char **p, const char *end, int *err)
+{
+    uint32_t len;
+    const char *s;
+
+    if (*err || end - *p < (ptrdiff_t)sizeof(len))
+	goto bad;
+    memcpy(&len, *p, sizeof(len));
+    *p += sizeof(len);
+    if (len == UINT32_MAX)
+	return NULL;
+    if (end - *p <= (ptrdiff_t)len || (*p)[len] != '\0')
+	goto bad;
+    s = *p;
+    *p += len + 1;
+    return s;
+
+bad:
+    *err = 1;
+    return NULL;
+}
+
+/* Walk the definitions of a snapshot, pushing them if mc is given */
+static int snapshotDefs(rpmMacroContext mc, const char *p, const char *end)
+{
+    int err = 0;
+    int n = 0;
+
+    while (!err && p < end) {
+	int32_t flags;
+	if (end - p < (ptrdiff_t)sizeof(flags))
+	    return -1;
+	memcpy(&flags, p, sizeof(flags));
+	flags &= SNAPSHOT_FLAGS;
+	p += sizeof(flags);
+	const char *name = snapReadStr(&p, end, &err);
+	const char *opts = snapReadStr(&p, end, &err);
+	const char *body = snapReadStr(&p, end, &err);
+	if (err || name == NULL || body == NULL)
+	    return -1;
+	if (mc)
+	    pushMacro(mc, name, opts, body, RMIL_MACROFILES, flags);
+	n++;
+    }
+    return n;
+}
+
+static int loadSnapshot(rpmMacroContext mc, const char *fn, const char *key)
+{
+    int fd = open(fn, O_RDONLY);
+    struct stat st;
+    void *map = MAP_FAILED;
+    int rc = -1;
+
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+	goto exit;
+    /* Only trust definitions nobody else could have put there */
+    if ((st.st_uid != geteuid() && st.st_uid != 0) ||
+		(st.st_mode & (S_IWGRP|S_IWOTH))) {
+	rpmlog(RPMLOG_WARNING, _("ignoring unsafe macro snapshot %s\n"), fn);
+	goto exit;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	goto exit;
+
+    const char *p = (const char *)map;
+    const char *end = p + st.st_size;
+    int err = 0;
+    const char *skey = snapReadStr(&p, end, &err);
+    if (err || skey == NULL || !rstreq(skey, key))
+	goto exit;
+
+    /* Don't leave a half loaded configuration behind */
+    if (snapshotDefs(NULL, p, end) < 0) {
+	rpmlog(RPMLOG_WARNING, _("corrupted macro snapshot %s\n"), fn);
+	goto exit;
+    }
+    rc = snapshotDefs(mc, p, end);
+    rpmlog(RPMLOG_DEBUG, "loaded %d macros from snapshot %s\n", rc, fn);
+
+exit:
+    if (map != MAP_FAILED)
+	munmap(map, st.st_size);
+    if (fd >= 0)
+	close(fd);
+    return (rc < 0) ? -1 : 0;
+}
+
+/* Store the definitions on top of each macro stack made by macro files */
+static void saveSnapshot(rpmMacroContext mc, const char *fn, const char *key)
+{
+    char *tmppath = rstrscat(NULL, fn, ".XXXXXX", NULL);
+    rpmMacroEntry *defs = NULL;
+    size_t ndefs = 0, nalloced = 0;
+    FILE *f = NULL;
+    int fd;
+    int n = 0;
+
+    if ((fd = mkstemp(tmppath)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+	if (fd >= 0)
+	    close(fd);
+	goto err;
+    }
+    /* Meant to be shared, unlike most temporary files */
+    (void) fchmod(fd, 0644);
+
+    snapWriteStr(f, key);
+    for (int i = 0; i < mc->n; i++) {
+	ndefs = 0;
+	for (rpmMacroEntry me = mc->tab[i]; me; me = me->prev) {
+	    if (me->level != RMIL_MACROFILES || (me->flags & ME_FUNC))
+		break;
+	    if (ndefs == nalloced) {
+		nalloced += 8;
+		defs = xrealloc(defs, nalloced * sizeof(*defs));
+	    }
+	    defs[ndefs++] = me;
+	}
+	/* Bottom-up, in the order they were pushed */
+	while (ndefs > 0) {
+	    rpmMacroEntry me = defs[--ndefs];
+	    int32_t flags = me->flags & SNAPSHOT_FLAGS;
+	    fwrite(&flags, sizeof(flags), 1, f);
+	    snapWriteStr(f, me->name);
+	    snapWriteStr(f, me->opts);
+	    snapWriteStr(f, me->body);
+	    n++;
+	}
+    }
+    free(defs);
+
+    if (ferror(f) | fclose(f) || rename(tmppath, fn))
+	goto err;
+
+    rpmlog(RPMLOG_DEBUG, "saved %d macros to snapshot %s\n", n, fn);
+    free(tmppath);
+    return;
+
+err:
+    /* Not being able to write to a shared location is normal for users */
+    rpmlog(RPMLOG_DEBUG, "unable to save macro snapshot %s: %s\n",
+	   fn, strerror(errno));
+    unlink(tmppath);
+    free(tmppath);
+}
+
+static void initMacros(rpmMacroContext mc, const char * macrofiles,
+			const char * snapshot)
+{
+    rpmMacroContext climc;
+    ARGV_t files = NULL;
+    char *key = NULL;
+    char *snappath = NULL;
+    mc = rpmmctxAcquire(mc);
+
+    /* Define built-in macros */
+    for (const struct builtins_s *b = builtinmacros; b->name; b++) {
+	pushMacroAny(mc, b->name, b->nargs ? "" : NULL, "<builtin>",
+		    b->func, NULL, b->nargs, RMIL_BUILTIN, b->flags | ME_FUNC);
+    }
+
+    files = macroFiles(macrofiles);
+    if (snapshot && *snapshot) {
+	key = snapshotKey(macrofiles, files);
+	snappath = snapshotPath(snapshot, macrofiles, files);
+    }
+
+    if (key == NULL || loadSnapshot(mc, snappath, key)) {
+	int nfailed = 0;
+
+	/* Read macros from each file. */
+	for (ARGV_const_t fn = files; fn && *fn; fn++)
+	    nfailed += (loadMacroFile(mc, *fn) != 0);
+
+	/* Files with errors need to keep reporting them */
+	if (key && nfailed == 0)
+	    saveSnapshot(mc, snappath, key);
+    }
+    argvFree(files);
+    free(snappath);
+    free(key);
 
     /* Reload cmdline macros */
     climc = rpmmctxAcquire(rpmCLIMacroContext);
@@ -2218,6 +2925,19 @@ rpmInitMacros(rpmMacroContext mc, const char * macrofiles)
     rpmmctxRelease(mc);
 }
 
+void
+rpmInitMacros(rpmMacroContext mc, const char * macrofiles)
+{
+    initMacros(mc, macrofiles, NULL);
+}
+
+void
+rpmInitMacrosSnapshot(rpmMacroContext mc, const char * macrofiles,
+			const char * snapshot)
+{
+    initMacros(mc, macrofiles, snapshot);
+}
+
 void
 rpmFreeMacros(rpmMacroContext mc)
 {
@@ -2228,6 +2948,11 @@ rpmFreeMacros(rpmMacroContext mc)
 	popMacro(mc, me->name);
     }
     rpmmctxRelease(mc);
+
+    pthread_mutex_lock(&shellOutputsLock);
+    if (mc == rpmGlobalMacroContext)
+	shellOutputs = shellCacheFree(shellOutputs);
+    pthread_mutex_unlock(&shellOutputsLock);
 }
 
 char * 
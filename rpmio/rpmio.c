@@ -1008,10 +1008,15 @@ typedef struct rpmzstd_s {
 	ZSTD_DStream *d;
 	ZSTD_CStream *c;
     } stream;
+    int threads;		/*!< worker threads */
+    int longdist;		/*!< long distance matching window log */
     size_t nb;
     void * b;
     ZSTD_inBuffer zib;          /*!< ZSTD_inBuffer */
     ZSTD_outBuffer zob;         /*!< ZSTD_outBuffer */
+    int inframe;		/*!< data written to the current frame? */
+    FILE * capture;		/*!< copy of the current frame */
+    FILE * replay;		/*!< precompressed current frame */
 } * rpmzstd;
 
 static rpmzstd rpmzstdNew(int fdno, const char *fmode)
@@ -1130,6 +1135,8 @@ static rpmzstd rpmzstdNew(int fdno, const char *fmode)
     zstd->flags = flags;
     zstd->fdno = fdno;
     zstd->level = level;
+    zstd->threads = threads;
+    zstd->longdist = longdist ? windowlog : 0;
     zstd->fp = fp;
     zstd->nb = nb;
     zstd->b = (uint8_t *)xmalloc(nb);
@@ -1162,6 +1169,44 @@ static FD_t zstdFdopen(FD_t fd, int fdno, const char * fmode)
     return fd;
 }
 
+/* Write compressed data, and a copy of it when capturing the frame */
+static int zstdOut(rpmzstd zstd, const void * buf, size_t count)
+{
+    if (count != fwrite(buf, 1, count, zstd->fp))
+	return -1;
+    /* A failed copy leaves the error on the capture file for the caller */
+    if (zstd->capture && count != fwrite(buf, 1, count, zstd->capture))
+	zstd->capture = NULL;
+    return 0;
+}
+
+/* Push out everything buffered, ZSTD_e_end also ends the frame */
+static int zstdDrain(FDSTACK_t fps, ZSTD_EndDirective op)
+{
+    rpmzstd zstd = zstdFp(fps);
+    int rc = -1;
+    int xx;
+
+    do {
+      ZSTD_inBuffer zib = { NULL, 0, 0 };
+      zstd->zob.dst  = zstd->b;
+      zstd->zob.size = zstd->nb;
+      zstd->zob.pos  = 0;
+      xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, op);
+      if (ZSTD_isError(xx)) {
+	  fps->errcookie = ZSTD_getErrorName(xx);
+	  break;
+      }
+      else if (zstdOut(zstd, zstd->b, zstd->zob.pos)) {
+	  fps->errcookie = "zstdClose fwrite failed.";
+	  break;
+      }
+      else
+	  rc = 0;
+    } while (xx != 0);
+    return rc;
+}
+
 static int zstdFlush(FDSTACK_t fps)
 {
     rpmzstd zstd = zstdFp(fps);
@@ -1170,26 +1215,10 @@ assert(zstd);
 
     if ((zstd->flags & O_ACCMODE) == O_RDONLY) { /* decompressing */
 	rc = 0;
-    } else {					/* compressing */
-	/* close frame */
-	int xx;
-	do {
-	  ZSTD_inBuffer zib = { NULL, 0, 0 };
-	  zstd->zob.dst  = zstd->b;
-	  zstd->zob.size = zstd->nb;
-	  zstd->zob.pos  = 0;
-	  xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_flush);
-	  if (ZSTD_isError(xx)) {
-	      fps->errcookie = ZSTD_getErrorName(xx);
-	      break;
-	  }
-	  else if (zstd->zob.pos != fwrite(zstd->b, 1, zstd->zob.pos, zstd->fp)) {
-	      fps->errcookie = "zstdClose fwrite failed.";
-	      break;
-	  }
-	  else
-	      rc = 0;
-	} while (xx != 0);
+    } else if (zstd->replay == NULL) {		/* compressing */
+	rc = zstdDrain(fps, ZSTD_e_flush);
+    } else {
+	rc = 0;
     }
     return rc;
 }
@@ -1226,6 +1255,12 @@ static ssize_t zstdWrite(FDSTACK_t fps, const void * buf, size_t count)
 assert(zstd);
     ZSTD_inBuffer zib = { buf, count, 0 };
 
+    zstd->inframe = 1;
+
+    /* The compressed frame is already there */
+    if (zstd->replay)
+	return count;
+
     while (zib.pos < zib.size) {
 
 	/* Reset to beginning of compressed data buffer. */
@@ -1242,8 +1277,7 @@ assert(zstd);
 
 	/* Write compressed data buffer. */
         if (zstd->zob.pos > 0) {
-	    size_t nw = fwrite(zstd->b, 1, zstd->zob.pos, zstd->fp);
-	    if (nw != zstd->zob.pos) {
+	    if (zstdOut(zstd, zstd->b, zstd->zob.pos)) {
 		fps->errcookie = "zstdWrite fwrite failed.";
 		return -1;
 	    }
@@ -1263,24 +1297,9 @@ assert(zstd);
 	ZSTD_freeDStream(zstd->stream.d);
     } else {					/* compressing */
 	/* close frame */
-	int xx;
-	do {
-	  ZSTD_inBuffer zib = { NULL, 0, 0 };
-	  zstd->zob.dst  = zstd->b;
-	  zstd->zob.size = zstd->nb;
-	  zstd->zob.pos  = 0;
-	  xx = ZSTD_compressStream2(zstd->stream.c, &zstd->zob, &zib, ZSTD_e_end);
-	  if (ZSTD_isError(xx)) {
-	      fps->errcookie = ZSTD_getErrorName(xx);
-	      break;
-	  }
-	  else if (zstd->zob.pos != fwrite(zstd->b, 1, zstd->zob.pos, zstd->fp)) {
-	      fps->errcookie = "zstdClose fwrite failed.";
-	      break;
-	  }
-	  else
-	      rc = 0;
-	} while (xx != 0);
+	zstd->replay = NULL;
+	zstd->capture = NULL;
+	rc = zstdDrain(fps, ZSTD_e_end);
 	ZSTD_freeCCtx(zstd->stream.c);
     }
 
@@ -1293,6 +1312,94 @@ assert(zstd);
     return rc;
 }
 
+/* Return the zstd compressor of fd, NULL if there's none */
+static FDSTACK_t zstdWriter(FD_t fd)
+{
+    FDSTACK_t fps = fd ? fdGetFps(fd) : NULL;
+    if (fps && fps->io == zstdio) {
+	rpmzstd zstd = zstdFp(fps);
+	if ((zstd->flags & O_ACCMODE) != O_RDONLY)
+	    return fps;
+    }
+    return NULL;
+}
+
+char * fdZstdParams(FD_t fd)
+{
+    FDSTACK_t fps = zstdWriter(fd);
+    char *params = NULL;
+
+    if (fps) {
+	rpmzstd zstd = zstdFp(fps);
+	/* Multi-threaded output doesn't depend on the number of threads */
+	rasprintf(&params, "zstd-%u-%d-L%d%s", ZSTD_versionNumber(),
+		  zstd->level, zstd->longdist, zstd->threads > 0 ? "-T" : "");
+    }
+    return params;
+}
+
+int fdZstdEndFrame(FD_t fd)
+{
+    FDSTACK_t fps = zstdWriter(fd);
+    int rc = -1;
+
+    if (fps) {
+	rpmzstd zstd = zstdFp(fps);
+	if (zstd->replay) {
+	    size_t nb;
+	    rc = 0;
+	    while ((nb = fread(zstd->b, 1, zstd->nb, zstd->replay)) > 0) {
+		if (zstdOut(zstd, zstd->b, nb)) {
+		    fps->errcookie = "zstdWrite fwrite failed.";
+		    rc = -1;
+		    break;
+		}
+	    }
+	    if (ferror(zstd->replay))
+		rc = -1;
+	    zstd->replay = NULL;
+	} else if (zstd->inframe) {
+	    rc = zstdDrain(fps, ZSTD_e_end);
+	} else {
+	    rc = 0;
+	}
+	zstd->inframe = 0;
+	zstd->capture = NULL;
+    }
+    return rc;
+}
+
+int fdZstdCapture(FD_t fd, FILE * fp, uint64_t size)
+{
+    FDSTACK_t fps = zstdWriter(fd);
+    if (fps == NULL || fp == NULL)
+	return -1;
+    rpmzstd zstd = zstdFp(fps);
+    /* Record the size in the frame header, it's checked on replay */
+    if (ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(zstd->stream.c, size)))
+	return -1;
+    zstd->capture = fp;
+    return 0;
+}
+
+int fdZstdReplay(FD_t fd, FILE * fp, uint64_t size)
+{
+    FDSTACK_t fps = zstdWriter(fd);
+    unsigned char hdr[18];	/* ZSTD_FRAMEHEADERSIZE_MAX */
+    size_t nb;
+
+    if (fps == NULL || fp == NULL)
+	return -1;
+
+    /* Only a frame of exactly the data to be written can stand in for it */
+    nb = fread(hdr, 1, sizeof(hdr), fp);
+    if (fseek(fp, 0, SEEK_SET) || ZSTD_getFrameContentSize(hdr, nb) != size)
+	return -1;
+
+    zstdFp(fps)->replay = fp;
+    return 0;
+}
+
 static const struct FDIO_s zstdio_s = {
   "zstdio", "zstd",
   zstdRead, zstdWrite, NULL, zstdClose,
@@ -1300,6 +1407,28 @@ static const struct FDIO_s zstdio_s = {
 };
 const FDIO_t zstdio = &zstdio_s ;
 
+#else	/* HAVE_ZSTD */
+
+char * fdZstdParams(FD_t fd)
+{
+    return NULL;
+}
+
+int fdZstdEndFrame(FD_t fd)
+{
+    return -1;
+}
+
+int fdZstdCapture(FD_t fd, FILE * fp, uint64_t size)
+{
+    return -1;
+}
+
+int fdZstdReplay(FD_t fd, FILE * fp, uint64_t size)
+{
+    return -1;
+}
+
 #endif	/* HAVE_ZSTD */
 
 /* =============================================================== */
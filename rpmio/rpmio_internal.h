@@ -27,6 +27,43 @@ void fdFiniDigest(FD_t fd, int id,
 
 DIGEST_CTX fdDupDigest(FD_t fd, int id);
 
+/** \ingroup rpmio
+ * Return the settings that determine the output of a zstd compressor,
+ * usable as a key for storing compressed frames.
+ * @param fd		zstdio fd open for writing
+ * @return		settings string (malloc'd), NULL if not zstd
+ */
+char * fdZstdParams(FD_t fd);
+
+/** \ingroup rpmio
+ * End the current zstd frame, the next write starts a new one. Finishes
+ * any capture or replay set up for the frame.
+ * @param fd		zstdio fd open for writing
+ * @return		0 on success
+ */
+int fdZstdEndFrame(FD_t fd);
+
+/** \ingroup rpmio
+ * Copy the compressed output of the current frame to fp as well.
+ * The frame records its size, exactly that much must be written to it.
+ * @param fd		zstdio fd open for writing
+ * @param fp		file to store the frame to
+ * @param size		uncompressed size of the frame
+ * @return		0 on success
+ */
+int fdZstdCapture(FD_t fd, FILE * fp, uint64_t size);
+
+/** \ingroup rpmio
+ * Replace the current frame by an already compressed one read from fp.
+ * Data written until the end of the frame is digested but not compressed,
+ * it must be exactly what the stored frame decompresses to.
+ * @param fd		zstdio fd open for writing
+ * @param fp		file to read the frame from
+ * @param size		uncompressed size of the frame
+ * @return		0 on success, -1 if the stored frame isn't of that size
+ */
+int fdZstdReplay(FD_t fd, FILE * fp, uint64_t size);
+
 /**
  * Read an entire file into a buffer.
  * @param fn		file name to read
@@ -111,6 +111,31 @@ rpmKeyring rpmKeyringLink(rpmKeyring keyring)
     return keyring;
 }
 
+char * rpmKeyringDigest(rpmKeyring keyring, int algo)
+{
+    char *digest = NULL;
+    DIGEST_CTX ctx;
+
+    if (keyring == NULL)
+	return NULL;
+
+    ctx = rpmDigestInit(algo, RPMDIGEST_NONE);
+    if (ctx == NULL)
+	return NULL;
+
+    /* Keys are kept sorted by keyid */
+    pthread_rwlock_rdlock(&keyring->lock);
+    for (size_t i = 0; i < keyring->numkeys; i++) {
+	rpmPubkey key = keyring->keys[i];
+	rpmDigestUpdate(ctx, key->keyid, sizeof(key->keyid));
+	rpmDigestUpdate(ctx, key->pkt, key->pktlen);
+    }
+    pthread_rwlock_unlock(&keyring->lock);
+
+    rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+    return digest;
+}
+
 rpmPubkey rpmPubkeyRead(const char *filename)
 {
     uint8_t *pkt = NULL;
@@ -15,6 +15,7 @@
 #include <fcntl.h>
 
 #include <rpm/rpmio.h>
+#include <rpm/rpmcrypto.h>
 #include <rpm/rpmmacro.h>
 #include <rpm/rpmlog.h>
 #include <rpm/rpmurl.h>
@@ -38,8 +39,11 @@ struct rpmlua_s {
     lua_State *L;
     size_t pushsize;
     rpmluapb printbuf;
+    int nchunks;	/* no. of compiled chunks in registry */
 };
 
+#define CHUNKS_MAX 1024
+
 #define INITSTATE(lua) \
     (lua = lua ? lua : \
 	    (globalLuaState ? globalLuaState : \
@@ -143,6 +147,9 @@ rpmlua rpmluaNew()
     lua_pushlightuserdata(L, (void *)lua);
     lua_rawset(L, LUA_REGISTRYINDEX);
 
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, "rpm_chunks");
+
     initlua = rpmGenPath(rpmConfigDir(), "init.lua", NULL);
     if (stat(initlua, &st) != -1)
 	(void)rpmluaRunScriptFile(lua, initlua);
@@ -205,6 +212,123 @@ char *rpmluaPopPrintBuffer(rpmlua lua)
     return ret;
 }
 
+/*
+ * Compiled chunks are kept in a registry table, keyed by chunk name and
+ * source, so scripts run over and over (macros, file triggers) are only
+ * compiled once. With %_lua_chunk_cache set, chunks are also saved there
+ * as bytecode for later invocations, in files named by a digest of the
+ * key. Lua doesn't verify bytecode, so the directory must not be
+ * writable by anybody untrusted.
+ */
+static char *chunkPath(const char *key, size_t keylen)
+{
+    char *dir = rpmExpand("%{?_lua_chunk_cache}", NULL);
+    char *digest = NULL;
+    char *path = NULL;
+
+    if (*dir && rpmioMkpath(dir, 0755, -1, -1) == 0) {
+	DIGEST_CTX ctx = rpmDigestInit(RPM_HASH_SHA256, RPMDIGEST_NONE);
+	rpmDigestUpdate(ctx, LUA_RELEASE, sizeof(LUA_RELEASE));
+	rpmDigestUpdate(ctx, key, keylen);
+	rpmDigestFinal(ctx, (void **)&digest, NULL, 1);
+	path = rstrscat(NULL, dir, "/", digest, ".luac", NULL);
+    }
+    free(digest);
+    free(dir);
+    return path;
+}
+
+static int chunkWriter(lua_State *L, const void *p, size_t sz, void *ud)
+{
+    return (fwrite(p, 1, sz, (FILE *)ud) != sz);
+}
+
+/* Save the chunk on top of the stack */
+static void chunkSave(lua_State *L, const char *path)
+{
+    char *tmppath = rstrscat(NULL, path, ".XXXXXX", NULL);
+    int fd = mkstemp(tmppath);
+    FILE *f = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    int rc = -1;
+
+    if (f) {
+#if LUA_VERSION_NUM >= 503
+	rc = lua_dump(L, chunkWriter, f, 0);
+#else
+	rc = lua_dump(L, chunkWriter, f);
+#endif
+	if (ferror(f) | fclose(f))
+	    rc = -1;
+	if (rc == 0)
+	    rc = rename(tmppath, path);
+    } else if (fd >= 0) {
+	close(fd);
+    }
+    if (rc && fd >= 0)
+	unlink(tmppath);
+    free(tmppath);
+}
+
+/* Push compiled chunk of a script, or an error message as luaL_load*() */
+static int loadChunk(rpmlua lua, const char *buf, size_t len, const char *name)
+{
+    lua_State *L = lua->L;
+    size_t namelen = strlen(name) + 1;
+    size_t keylen = namelen + len;
+    char *key = (char *)xmalloc(keylen);
+    char *path = NULL;
+    uint8_t *code = NULL;
+    ssize_t codelen = 0;
+    int loaded = 0;
+    int rc = 0;
+
+    memcpy(key, name, namelen);
+    memcpy(key + namelen, buf, len);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, "rpm_chunks");
+    lua_pushlstring(L, key, keylen);
+    lua_rawget(L, -2);
+    if (lua_type(L, -1) == LUA_TFUNCTION)
+	goto exit;
+    lua_pop(L, 1);
+
+    path = chunkPath(key, keylen);
+    if (path && rpmioSlurp(path, &code, &codelen) == 0 && code) {
+	if (luaL_loadbufferx(L, (char *)code, codelen, name, "b") == LUA_OK) {
+	    rpmlog(RPMLOG_DEBUG, "using compiled lua chunk %s\n", path);
+	    loaded = 1;
+	} else {
+	    lua_pop(L, 1);	/* stale or foreign bytecode */
+	}
+    }
+    if (!loaded) {
+	if ((rc = luaL_loadbuffer(L, buf, len, name)) != LUA_OK)
+	    goto exit;
+	if (path)
+	    chunkSave(L, path);
+    }
+
+    /* Start over rather than grow without bounds */
+    if (lua->nchunks >= CHUNKS_MAX) {
+	lua_newtable(L);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "rpm_chunks");
+	lua_replace(L, -3);
+	lua->nchunks = 0;
+    }
+    lua_pushlstring(L, key, keylen);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    lua->nchunks++;
+
+exit:
+    lua_remove(L, -2);	/* chunk table */
+    free(code);
+    free(path);
+    free(key);
+    return rc;
+}
+
 int rpmluaCheckScript(rpmlua lua, const char *script, const char *name)
 {
     INITSTATE(lua);
@@ -265,7 +389,7 @@ int rpmluaRunScript(rpmlua lua, const char *script, const char *name,
 
     char *buf = rstrscat(NULL, lualocal, script, NULL);
 
-    if (luaL_loadbuffer(L, buf, strlen(buf), name) != 0) {
+    if (loadChunk(lua, buf, strlen(buf), name) != 0) {
 	rpmlog(RPMLOG_ERR, _("invalid syntax in lua script: %s\n"),
 		 lua_tostring(L, -1));
 	lua_pop(L, 1);
@@ -437,7 +561,7 @@ char *rpmluaCallStringFunction(rpmlua lua, const char *function, rpmhookArgs arg
 
     /* compile the call */
     rasprintf(&fcall, "return (%s)(...)", function);
-    if (luaL_loadbuffer(L, fcall, strlen(fcall), function) != 0) {
+    if (loadChunk(lua, fcall, strlen(fcall), function) != 0) {
 	rpmlog(RPMLOG_ERR, "%s: %s\n", function, lua_tostring(L, -1));
 	lua_pop(L, 1);
 	free(fcall);
@@ -2,6 +2,7 @@
 #define	_H_MACRO_INTERNAL
 
 #include <rpm/rpmutil.h>
+#include <rpm/rpmmacro.h>
 #include <rpm/argv.h>
 
 /** \ingroup rpmio
@@ -30,4 +31,26 @@ void splitQuoted(ARGV_t *av, const char * str, const char * seps);
 RPM_GNUC_INTERNAL
 char *unsplitQuoted(ARGV_const_t av, const char *sep);
 
+/** \ingroup rpmmacro
+ * Calculate a digest of all macro definitions in a context, for detecting
+ * configuration changes. Whether macros have been used doesn't matter.
+ * Exported for the spec query cache of librpmbuild.
+ * @param mc		macro context (NULL uses global context)
+ * @param algo		digest algorithm
+ * @return		digest as hex string (malloc'ed)
+ */
+char *rpmMacroContextDigest(rpmMacroContext mc, int algo);
+
+/** \ingroup rpmmacro
+ * Initialize macro context from set of macrofile(s), using a snapshot
+ * of the definitions in the files when it's up to date. The snapshot
+ * is (re)created when it's missing or stale. Exported for
+ * rpmReadConfigFiles() of librpm.
+ * @param mc		macro context
+ * @param macrofiles	colon separated list of macro files
+ * @param snapshot	path of macro snapshot (NULL or empty to not use one)
+ */
+void rpmInitMacrosSnapshot(rpmMacroContext mc, const char * macrofiles,
+			const char * snapshot);
+
 #endif	/* _H_ MACRO_INTERNAL */
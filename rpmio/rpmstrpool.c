@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <rpm/rpmstring.h>
 #include <rpm/rpmstrpool.h>
+#include <rpm/rpmver.h>
 #include "debug.h"
 
 #define STRDATA_CHUNKS 1024
@@ -39,6 +40,8 @@ struct rpmstrPool_s {
     size_t chunk_used;		/* usage of the current chunk */
 
     poolHash hash;		/* string -> sid hash table */
+    char ** evrkeys;		/* sid -> EVR sort key cache */
+    rpmsid evrkeys_alloced;	/* EVR sort key cache allocation size */
     int frozen;			/* are new id additions allowed? */
     int nrefs;			/* refcount */
     pthread_rwlock_t lock;
@@ -274,6 +277,9 @@ rpmstrPool rpmstrPoolFree(rpmstrPool pool)
 		poolHashPrintStats(pool);
 	    poolHashFree(pool->hash);
 	    free(pool->offs);
+	    for (int i = 0; i < pool->evrkeys_alloced; i++)
+		free(pool->evrkeys[i]);
+	    free(pool->evrkeys);
 	    for (int i=1;i<=pool->chunks_size;i++) {
 		pool->chunks[i] = _free(pool->chunks[i]);
 	    }
@@ -490,3 +496,50 @@ rpmsid rpmstrPoolNumStr(rpmstrPool pool)
     }
     return n;
 }
+
+const char * rpmstrPoolEVRKey(rpmstrPool pool, rpmsid sid)
+{
+    const char *key = NULL;
+    const char *evr;
+    char *nkey;
+
+    if (pool == NULL)
+	return NULL;
+
+    poolLock(pool, 0);
+    evr = id2str(pool, sid);
+    if (evr && sid < pool->evrkeys_alloced)
+	key = pool->evrkeys[sid];
+    poolUnlock(pool);
+
+    if (evr == NULL || key != NULL)
+	return key;
+
+    /* compute outside the lock, pool strings never move */
+    if (*evr) {
+	rpmver rv = rpmverParse(evr);
+	nkey = rpmverKey(rv);
+	rpmverFree(rv);
+    } else {
+	nkey = xstrdup("");
+    }
+
+    poolLock(pool, 1);
+    if (sid >= pool->evrkeys_alloced) {
+	rpmsid nalloced = pool->offs_alloced > sid ? pool->offs_alloced : sid + 1;
+	pool->evrkeys = xrealloc(pool->evrkeys,
+				 nalloced * sizeof(*pool->evrkeys));
+	memset(pool->evrkeys + pool->evrkeys_alloced, 0,
+	       (nalloced - pool->evrkeys_alloced) * sizeof(*pool->evrkeys));
+	pool->evrkeys_alloced = nalloced;
+    }
+    if (pool->evrkeys[sid] == NULL) {
+	pool->evrkeys[sid] = nkey;
+	nkey = NULL;
+    }
+    key = pool->evrkeys[sid];
+    poolUnlock(pool);
+
+    free(nkey);
+    return key;
+}
@@ -126,6 +126,40 @@ int rpmverCmp(rpmver v1, rpmver v2)
     return rc;
 }
 
+struct verKey_s {
+    char *key;
+    rpmver rv;
+};
+
+static int verKeyCmp(const void *a, const void *b)
+{
+    const struct verKey_s *ka = (const struct verKey_s *)a;
+    const struct verKey_s *kb = (const struct verKey_s *)b;
+    return strcmp(ka->key, kb->key);
+}
+
+void rpmverSort(rpmver *vers, size_t nvers)
+{
+    struct verKey_s *keys;
+
+    if (vers == NULL || nvers < 2)
+	return;
+
+    keys = (struct verKey_s *)xmalloc(nvers * sizeof(*keys));
+    for (size_t i = 0; i < nvers; i++) {
+	keys[i].key = vers[i] ? rpmverKey(vers[i]) : xstrdup("");
+	keys[i].rv = vers[i];
+    }
+
+    qsort(keys, nvers, sizeof(*keys), verKeyCmp);
+
+    for (size_t i = 0; i < nvers; i++) {
+	vers[i] = keys[i].rv;
+	free(keys[i].key);
+    }
+    free(keys);
+}
+
 uint32_t rpmverEVal(rpmver rv)
 {
     return (rv != NULL && rv->e != NULL) ? atol(rv->e) : 0;
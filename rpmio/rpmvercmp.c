@@ -5,6 +5,7 @@
 #include "system.h"
 
 #include <rpm/rpmlib.h>		/* rpmvercmp proto */
+#include <rpm/rpmver.h>
 #include <rpm/rpmstring.h>
 
 #include "debug.h"
@@ -136,3 +137,112 @@ int rpmvercmp(const char * a, const char * b)
     if (!*one) return -1; else return 1;
 }
 
+
+/*
+ * Sort key token types, in the order rpmvercmp() sorts them. None of the
+ * bytes in a key is ever zero, so keys can be handled as C strings.
+ */
+#define VK_NONE		0x01	/* missing component, alpha terminator */
+#define VK_TILDE	0x02	/* sorts before everything, including end */
+#define VK_END		0x03
+#define VK_CARET	0x04	/* sorts after end, before any segment */
+#define VK_ALPHA	0x05	/* alpha segment, followed by VK_NONE */
+#define VK_NUM		0x06	/* numeric segment, length prefixed */
+
+/* Maximum size of the encoded key of a string of length n, sans '\0' */
+#define VK_MAXLEN(_n)	(3 * (_n) + 1)
+
+/* Encode version string s as sort key to t, return pointer to its end */
+static char *vercmpKeyEncode(const char *s, char *t)
+{
+    unsigned char *k = (unsigned char *)t;
+
+    while (*s) {
+	if (*s == '~') {
+	    *k++ = VK_TILDE;
+	    s++;
+	} else if (*s == '^') {
+	    *k++ = VK_CARET;
+	    s++;
+	} else if (risdigit(*s)) {
+	    const char *se;
+	    size_t len;
+
+	    /* leading zeros don't count, the longer number wins */
+	    while (*s == '0')
+		s++;
+	    for (se = s; risdigit(*se); se++)
+		;
+	    len = se - s;
+
+	    *k++ = VK_NUM;
+	    if (len < 0xfe) {
+		*k++ = len + 1;
+	    } else {
+		/* fixed width base-255 length, sorts after all short ones */
+		*k++ = 0xff;
+		for (int i = 3; i >= 0; i--) {
+		    size_t d = len;
+		    for (int j = 0; j < i; j++)
+			d /= 255;
+		    *k++ = (d % 255) + 1;
+		}
+	    }
+	    memcpy(k, s, len);
+	    k += len;
+	    s = se;
+	} else if (risalpha(*s)) {
+	    *k++ = VK_ALPHA;
+	    while (risalpha(*s))
+		*k++ = *s++;
+	    *k++ = VK_NONE;
+	} else {
+	    /* everything else is a separator and only splits segments */
+	    s++;
+	}
+    }
+    *k++ = VK_END;
+    *k = '\0';
+
+    return (char *)k;
+}
+
+char *rpmvercmpKey(const char *s)
+{
+    char *key = NULL;
+    if (s) {
+	key = (char *)xmalloc(VK_MAXLEN(strlen(s)) + 1);
+	vercmpKeyEncode(s, key);
+    }
+    return key;
+}
+
+char *rpmverKey(rpmver rv)
+{
+    char *key = NULL;
+
+    if (rv) {
+	const char *e = rpmverE(rv) ? rpmverE(rv) : "0";
+	const char *v = rpmverV(rv);
+	const char *r = rpmverR(rv);
+	size_t nb = VK_MAXLEN(strlen(e)) + VK_MAXLEN(v ? strlen(v) : 0) +
+		    VK_MAXLEN(r ? strlen(r) : 0) + 1;
+	char *t = key = (char *)xmalloc(nb);
+
+	/* like rpmverCmp(), a missing component sorts before any value */
+	t = vercmpKeyEncode(e, t);
+	if (v) {
+	    t = vercmpKeyEncode(v, t);
+	} else {
+	    *t++ = VK_NONE;
+	    *t = '\0';
+	}
+	if (r) {
+	    t = vercmpKeyEncode(r, t);
+	} else {
+	    *t++ = VK_NONE;
+	    *t = '\0';
+	}
+    }
+    return key;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include <rpm/rpmlib.h>
+#include <rpm/rpmver.h>
 
 #include "debug.h"
 #include "system.h"
@@ -82,41 +83,46 @@ static void split_package_string(char *package_string, char **name,
     }
 }
 
-/* A package name-version-release comparator for qsort.  It expects p, q which
- * are pointers to character strings and will not be altered in this
- * function. */
-static int package_version_compare(const void *p, const void *q)
+/* A package with precomputed version and release sort keys */
+struct sortpkg_s {
+    char *line;			/* original input line */
+    char *name;			/* name part of a copy of the line */
+    char *vkey;			/* version sort key */
+    char *rkey;			/* release sort key */
+};
+
+static void sortpkg_init(struct sortpkg_s *pkg, char *line)
 {
-    char *local_p, *local_q;
-    char *lhs_name, *lhs_version, *lhs_release;
-    char *rhs_name, *rhs_version, *rhs_release;
-    int vercmpflag = 0;
+    char *version, *release;
 
-    local_p = rstrdup(*(char * const *)p);
-    local_q = rstrdup(*(char * const *)q);
+    pkg->line = line;
+    pkg->name = rstrdup(line);
+    split_package_string(pkg->name, &pkg->name, &version, &release);
+    pkg->vkey = rpmvercmpKey(version == NULL ? "" : version);
+    pkg->rkey = rpmvercmpKey(release == NULL ? "" : release);
+}
 
-    split_package_string(local_p, &lhs_name, &lhs_version, &lhs_release);
-    split_package_string(local_q, &rhs_name, &rhs_version, &rhs_release);
+/* A package name-version-release comparator for qsort. Versions and
+ * releases are compared via their sort keys, which compare the same as
+ * rpmvercmp() would on the strings. */
+static int package_version_compare(const void *p, const void *q)
+{
+    const struct sortpkg_s *lhs = (const struct sortpkg_s *)p;
+    const struct sortpkg_s *rhs = (const struct sortpkg_s *)q;
+    int vercmpflag;
 
     /* Check Name and return if unequal */
-    vercmpflag = strcmp((lhs_name == NULL ? "" : lhs_name),
-			(rhs_name == NULL ? "" : rhs_name));
+    vercmpflag = strcmp(lhs->name, rhs->name);
     if (vercmpflag != 0)
-	goto exit;
+	return vercmpflag;
 
     /* Check version and return if unequal */
-    vercmpflag = rpmvercmp((lhs_version == NULL ? "" : lhs_version),
-			   (rhs_version == NULL ? "" : rhs_version));
+    vercmpflag = strcmp(lhs->vkey, rhs->vkey);
     if (vercmpflag != 0)
-	goto exit;
+	return vercmpflag;
 
     /* Check release and return the version compare value */
-    vercmpflag = rpmvercmp((lhs_release == NULL ? "" : lhs_release),
-			   (rhs_release == NULL ? "" : rhs_release));
-exit:
-    rfree(local_p);
-    rfree(local_q);
-    return vercmpflag;
+    return strcmp(lhs->rkey, rhs->rkey);
 }
 
 static void add_input(const char *filename, char ***package_names,
@@ -178,6 +184,7 @@ int main(int argc, const char *argv[])
     char **package_names = NULL;
     size_t n_package_names = 0;
     char seen_file = 0;
+    struct sortpkg_s *pkgs;
 
     optCon = poptGetContext(NULL, argc, argv, optionsTable, 0);
     poptSetOtherOptionHelp(optCon, "<FILES>");
@@ -200,15 +207,23 @@ int main(int argc, const char *argv[])
 	exit(EXIT_FAILURE);
     }
 
-    qsort(package_names, n_package_names, sizeof(char *),
-	  package_version_compare);
+    /* Split and compute the sort keys just once per package */
+    pkgs = (struct sortpkg_s *)xmalloc(n_package_names * sizeof(*pkgs));
+    for (int i = 0; i < n_package_names; i++)
+	sortpkg_init(&pkgs[i], package_names[i]);
+
+    qsort(pkgs, n_package_names, sizeof(*pkgs), package_version_compare);
 
     /* Send sorted list to stdout. */
     for (int i = 0; i < n_package_names; i++) {
-	fprintf(stdout, "%s\n", package_names[i]);
-	free(package_names[i]);
+	fprintf(stdout, "%s\n", pkgs[i].line);
+	free(pkgs[i].line);
+	free(pkgs[i].name);
+	free(pkgs[i].vkey);
+	free(pkgs[i].rkey);
     }
 
+    free(pkgs);
     free(package_names);
     poptFreeContext(optCon);
     return 0;